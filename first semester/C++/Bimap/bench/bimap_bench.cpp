@@ -0,0 +1,395 @@
+// g++ -std=c++17 -O2 bimap_bench.cpp -o bimap_bench
+// ./bimap_bench [--json] [size...]
+//
+// bimap against a pair of std::map and a pair of std::unordered_map with
+// int and string keys; one line per (container, keys, size, operation) as
+// CSV or JSON lines, nanoseconds per operation or bytes per pair
+
+#include "../bimap.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+std::size_t allocated = 0;
+
+template <typename T>
+struct counting_allocator {
+  using value_type = T;
+
+  counting_allocator() noexcept = default;
+
+  template <typename U>
+  counting_allocator(counting_allocator<U> const&) noexcept {}
+
+  T* allocate(std::size_t n) {
+    allocated += n * sizeof(T);
+    return std::allocator<T>().allocate(n);
+  }
+
+  void deallocate(T* ptr, std::size_t n) noexcept {
+    allocated -= n * sizeof(T);
+    std::allocator<T>().deallocate(ptr, n);
+  }
+
+  friend bool operator==(counting_allocator const&,
+                         counting_allocator const&) noexcept {
+    return true;
+  }
+
+  friend bool operator!=(counting_allocator const&,
+                         counting_allocator const&) noexcept {
+    return false;
+  }
+};
+
+template <typename L, typename R>
+struct bimap_adapter {
+  static constexpr char const* NAME = "bimap";
+  static constexpr bool ORDERED = true;
+
+  void insert(L const& left, R const& right) {
+    map.insert(left, right);
+  }
+
+  bool find_left(L const& left) const {
+    return map.find_left(left) != map.end_left();
+  }
+
+  bool find_right(R const& right) const {
+    return map.find_right(right) != map.end_right();
+  }
+
+  bool lower_bound_left(L const& left) const {
+    return map.lower_bound_left(left) != map.end_left();
+  }
+
+  template <typename F>
+  void iterate_left(F&& f) const {
+    for (auto it = map.begin_left(); it != map.end_left(); ++it) {
+      f(*it);
+    }
+  }
+
+  template <typename F>
+  void iterate_right(F&& f) const {
+    for (auto it = map.begin_right(); it != map.end_right(); ++it) {
+      f(*it);
+    }
+  }
+
+  // the element of the other side for every element of the left one
+  template <typename F>
+  void flip_all(F&& f) const {
+    for (auto it = map.begin_left(); it != map.end_left(); ++it) {
+      f(*it.flip());
+    }
+  }
+
+  void erase_left(L const& left) {
+    map.erase_left(left);
+  }
+
+  void erase_first() {
+    map.erase_left(map.begin_left());
+  }
+
+  bimap<L, R, std::less<L>, std::less<R>, counting_allocator<std::pair<L, R>>>
+      map;
+};
+
+// std::map or std::unordered_map for each side
+template <typename L, typename R, bool Ordered>
+struct two_maps_adapter {
+  static constexpr char const* NAME = Ordered ? "std::map x2"
+                                              : "std::unordered_map x2";
+  static constexpr bool ORDERED = Ordered;
+
+  template <typename K, typename V>
+  using map_t = std::conditional_t<
+      Ordered,
+      std::map<K, V, std::less<K>, counting_allocator<std::pair<K const, V>>>,
+      std::unordered_map<K, V, std::hash<K>, std::equal_to<K>,
+                         counting_allocator<std::pair<K const, V>>>>;
+
+  void insert(L const& left, R const& right) {
+    if (by_left.count(left) == 0 && by_right.count(right) == 0) {
+      by_left.emplace(left, right);
+      by_right.emplace(right, left);
+    }
+  }
+
+  bool find_left(L const& left) const {
+    return by_left.find(left) != by_left.end();
+  }
+
+  bool find_right(R const& right) const {
+    return by_right.find(right) != by_right.end();
+  }
+
+  bool lower_bound_left(L const& left) const {
+    if constexpr (Ordered) {
+      return by_left.lower_bound(left) != by_left.end();
+    } else {
+      return false;
+    }
+  }
+
+  template <typename F>
+  void iterate_left(F&& f) const {
+    for (auto const& curr : by_left) {
+      f(curr.first);
+    }
+  }
+
+  template <typename F>
+  void iterate_right(F&& f) const {
+    for (auto const& curr : by_right) {
+      f(curr.first);
+    }
+  }
+
+  template <typename F>
+  void flip_all(F&& f) const {
+    for (auto const& curr : by_left) {
+      f(by_right.find(curr.second)->first);
+    }
+  }
+
+  void erase_left(L const& left) {
+    auto it = by_left.find(left);
+    if (it != by_left.end()) {
+      by_right.erase(it->second);
+      by_left.erase(it);
+    }
+  }
+
+  void erase_first() {
+    auto it = by_left.begin();
+    by_right.erase(it->second);
+    by_left.erase(it);
+  }
+
+  map_t<L, R> by_left;
+  map_t<R, L> by_right;
+};
+
+template <typename L, typename R>
+using map_adapter = two_maps_adapter<L, R, true>;
+
+template <typename L, typename R>
+using unordered_adapter = two_maps_adapter<L, R, false>;
+
+bool json = false;
+std::size_t sink = 0;
+
+void report(char const* container, char const* keys, std::size_t size,
+            char const* op, double value) {
+  if (json) {
+    std::printf("{\"container\":\"%s\",\"keys\":\"%s\",\"size\":%zu,"
+                "\"op\":\"%s\",\"value\":%.2f}\n",
+                container, keys, size, op, value);
+  } else {
+    std::printf("%s,%s,%zu,%s,%.2f\n", container, keys, size, op, value);
+  }
+  std::fflush(stdout);
+}
+
+template <typename F>
+double nanos(F&& f) {
+  auto start = std::chrono::steady_clock::now();
+  f();
+  std::chrono::duration<double, std::nano> time =
+      std::chrono::steady_clock::now() - start;
+  return time.count();
+}
+
+int to_key(int x, int*) {
+  return x;
+}
+
+std::string to_key(int x, std::string*) {
+  char buf[32];
+  std::snprintf(buf, sizeof(buf), "key-%012d", x);
+  return buf;
+}
+
+template <typename T>
+std::vector<T> make_keys(std::vector<int> const& values) {
+  std::vector<T> res;
+  res.reserve(values.size());
+  for (int x : values) {
+    res.push_back(to_key(x, static_cast<T*>(nullptr)));
+  }
+  return res;
+}
+
+// pairs (2i, 2p(i) + 1) for a random permutation p, so odd lefts and even
+// rights are misses
+template <template <typename, typename> typename Adapter, typename T>
+void run(char const* keys_name, std::size_t n) {
+  using adapter_t = Adapter<T, T>;
+  char const* name = adapter_t::NAME;
+  std::mt19937 gen(static_cast<unsigned>(n));
+
+  std::vector<int> order(n);
+  for (std::size_t i = 0; i < n; i++) {
+    order[i] = static_cast<int>(i);
+  }
+  std::vector<int> perm = order;
+  std::shuffle(perm.begin(), perm.end(), gen);
+
+  std::vector<int> left_values(n), right_values(n), left_miss(n),
+      right_miss(n);
+  for (std::size_t i = 0; i < n; i++) {
+    left_values[i] = 2 * order[i];
+    right_values[i] = 2 * perm[i] + 1;
+    left_miss[i] = 2 * order[i] + 1;
+    right_miss[i] = 2 * perm[i];
+  }
+  std::vector<T> lefts = make_keys<T>(left_values);
+  std::vector<T> rights = make_keys<T>(right_values);
+  std::vector<T> lefts_miss = make_keys<T>(left_miss);
+  std::vector<T> rights_miss = make_keys<T>(right_miss);
+
+  std::vector<std::size_t> random_order(n);
+  for (std::size_t i = 0; i < n; i++) {
+    random_order[i] = i;
+  }
+  std::shuffle(random_order.begin(), random_order.end(), gen);
+
+  // small sizes are repeated so that every measurement is long enough
+  std::size_t reps =
+      std::max<std::size_t>(1, 1000000 / std::max<std::size_t>(n, 1));
+  double ops = static_cast<double>(reps * n);
+
+  auto build = [&](adapter_t& map, auto const& sequence) {
+    for (std::size_t i : sequence) {
+      map.insert(lefts[i], rights[i]);
+    }
+  };
+  std::vector<std::size_t> reverse_order(order.rbegin(), order.rend());
+  std::vector<std::size_t> sorted_order(order.begin(), order.end());
+
+  auto time_insert = [&](char const* op, auto const& sequence) {
+    double total = 0;
+    for (std::size_t r = 0; r < reps; r++) {
+      adapter_t map;
+      total += nanos([&] { build(map, sequence); });
+    }
+    report(name, keys_name, n, op, total / ops);
+  };
+  time_insert("insert_random", random_order);
+  time_insert("insert_sorted", sorted_order);
+  time_insert("insert_reverse", reverse_order);
+
+  std::size_t before = allocated;
+  adapter_t map;
+  build(map, random_order);
+  report(name, keys_name, n, "bytes_per_pair",
+         static_cast<double>(allocated - before) / static_cast<double>(n));
+
+  auto time_lookup = [&](char const* op, auto&& probe) {
+    double total = nanos([&] {
+      for (std::size_t r = 0; r < reps; r++) {
+        for (std::size_t i : random_order) {
+          sink += probe(i);
+        }
+      }
+    });
+    report(name, keys_name, n, op, total / ops);
+  };
+  time_lookup("find_left_hit",
+              [&](std::size_t i) { return map.find_left(lefts[i]); });
+  time_lookup("find_left_miss",
+              [&](std::size_t i) { return map.find_left(lefts_miss[i]); });
+  time_lookup("find_right_hit",
+              [&](std::size_t i) { return map.find_right(rights[i]); });
+  time_lookup("find_right_miss",
+              [&](std::size_t i) { return map.find_right(rights_miss[i]); });
+  if (adapter_t::ORDERED) {
+    time_lookup("lower_bound_left", [&](std::size_t i) {
+      return map.lower_bound_left(lefts_miss[i]);
+    });
+  }
+
+  auto time_scan = [&](char const* op, auto&& scan) {
+    double total = nanos([&] {
+      for (std::size_t r = 0; r < reps; r++) {
+        scan([](T const& x) { sink += sizeof(x); });
+      }
+    });
+    report(name, keys_name, n, op, total / ops);
+  };
+  time_scan("iterate_left", [&](auto&& f) { map.iterate_left(f); });
+  time_scan("iterate_right", [&](auto&& f) { map.iterate_right(f); });
+  time_scan("flip", [&](auto&& f) { map.flip_all(f); });
+
+  double copy_total = 0;
+  for (std::size_t r = 0; r < reps; r++) {
+    copy_total += nanos([&] {
+      adapter_t copy(map);
+      sink += copy.find_left(lefts[0]);
+    });
+  }
+  report(name, keys_name, n, "copy", copy_total / ops);
+
+  auto time_erase = [&](char const* op, auto&& erase) {
+    double total = 0;
+    for (std::size_t r = 0; r < reps; r++) {
+      adapter_t victim;
+      build(victim, random_order);
+      total += nanos([&] { erase(victim); });
+    }
+    report(name, keys_name, n, op, total / ops);
+  };
+  time_erase("erase_random", [&](adapter_t& victim) {
+    for (std::size_t i : random_order) {
+      victim.erase_left(lefts[i]);
+    }
+  });
+  time_erase("erase_from_begin", [&](adapter_t& victim) {
+    for (std::size_t i = 0; i < n; i++) {
+      victim.erase_first();
+    }
+  });
+}
+
+template <typename T>
+void run_all(char const* keys_name, std::size_t n) {
+  run<bimap_adapter, T>(keys_name, n);
+  run<map_adapter, T>(keys_name, n);
+  run<unordered_adapter, T>(keys_name, n);
+}
+} // namespace
+
+int main(int argc, char** argv) {
+  std::vector<std::size_t> sizes;
+  for (int i = 1; i < argc; i++) {
+    if (std::strcmp(argv[i], "--json") == 0) {
+      json = true;
+    } else {
+      sizes.push_back(std::strtoull(argv[i], nullptr, 10));
+    }
+  }
+  if (sizes.empty()) {
+    sizes = {1000, 100000, 1000000};
+  }
+
+  if (!json) {
+    std::printf("container,keys,size,op,value\n");
+  }
+  for (std::size_t n : sizes) {
+    run_all<int>("int", n);
+    run_all<std::string>("string", n);
+  }
+  return sink == 42 ? 1 : 0;
+}
@@ -0,0 +1,90 @@
+// g++ -std=c++17 -O2 btree_bench.cpp -o btree_bench
+// ./btree_bench [size]
+
+#include "../bimap.h"
+#include "../btree_bimap.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+template <typename F>
+double millis(F&& f) {
+  auto start = std::chrono::steady_clock::now();
+  f();
+  std::chrono::duration<double, std::milli> time =
+      std::chrono::steady_clock::now() - start;
+  return time.count();
+}
+
+// inserts keys in random order, then looks all of them up from the left and
+// from the right in another random order and walks both sides in order
+template <typename Map, typename T>
+void run(char const* name, std::vector<T> const& keys) {
+  std::vector<std::size_t> order(keys.size());
+  for (std::size_t i = 0; i < order.size(); i++) {
+    order[i] = i;
+  }
+  std::mt19937 gen(1);
+  std::shuffle(order.begin(), order.end(), gen);
+
+  Map map;
+  double insert = millis([&] {
+    for (std::size_t i : order) {
+      map.insert(keys[i], keys[order.size() - 1 - i]);
+    }
+  });
+
+  std::shuffle(order.begin(), order.end(), gen);
+  std::size_t found = 0;
+  double find_left = millis([&] {
+    for (std::size_t i : order) {
+      found += map.find_left(keys[i]) != map.end_left();
+    }
+  });
+  double find_right = millis([&] {
+    for (std::size_t i : order) {
+      found += map.find_right(keys[i]) != map.end_right();
+    }
+  });
+
+  std::size_t walked = 0;
+  double scan = millis([&] {
+    for (auto it = map.begin_left(); it != map.end_left(); ++it) {
+      walked += *it == *it.flip();
+    }
+    for (auto it = map.begin_right(); it != map.end_right(); ++it) {
+      walked++;
+    }
+  });
+
+  std::printf("%s,%zu,%.1f,%.1f,%.1f,%.1f\n", name, keys.size(), insert,
+              find_left, find_right, scan);
+  if (found != 2 * keys.size() || walked < keys.size()) {
+    std::printf("wrong result\n");
+  }
+}
+} // namespace
+
+int main(int argc, char** argv) {
+  std::size_t size = argc > 1 ? std::atoi(argv[1]) : 1000000;
+
+  std::vector<int> ints(size);
+  std::vector<std::string> strings(size);
+  for (std::size_t i = 0; i < size; i++) {
+    ints[i] = static_cast<int>(i * 2);
+    strings[i] = "key-" + std::to_string(i * 7919 % size);
+  }
+
+  std::printf("map,size,insert ms,find_left ms,find_right ms,scan ms\n");
+  run<bimap<int, int>>("treap int", ints);
+  run<btree_bimap<int, int>>("btree int", ints);
+  run<bimap<std::string, std::string>>("treap string", strings);
+  run<btree_bimap<std::string, std::string>>("btree string", strings);
+  return 0;
+}
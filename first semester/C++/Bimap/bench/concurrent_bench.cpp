@@ -0,0 +1,119 @@
+// g++ -std=c++17 -O2 -pthread concurrent_bench.cpp -o concurrent_bench
+// ./concurrent_bench [size] [max threads] [milliseconds per run]
+
+#include "../concurrent_bimap.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using map_t = bimap<int, int>;
+
+struct locked_bimap {
+  explicit locked_bimap(map_t const& initial) : map(initial) {}
+
+  bool contains_left(int key) const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return map.find_left(key) != map.end_left();
+  }
+
+  void update(int left, int right) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    map.erase_left(left);
+    map.insert(left, right);
+  }
+
+private:
+  mutable std::shared_mutex mutex;
+  map_t map;
+};
+
+struct lr_bimap {
+  explicit lr_bimap(map_t const& initial) : map(initial) {}
+
+  bool contains_left(int key) const {
+    return map.contains_left(key);
+  }
+
+  void update(int left, int right) {
+    map.update([left, right](map_t& curr) {
+      curr.erase_left(left);
+      curr.insert(left, right);
+    });
+  }
+
+private:
+  concurrent_bimap<int, int> map;
+};
+
+// readers look up random keys, one writer changes a pair every 100us
+template <typename Map>
+double run(Map& map, int size, int readers, int millis) {
+  std::atomic<bool> stop{false};
+  std::vector<std::size_t> done(readers * 8);
+  std::vector<std::thread> threads;
+
+  for (int i = 0; i < readers; i++) {
+    threads.emplace_back([&, i] {
+      std::mt19937 gen(i);
+      std::size_t found = 0, ops = 0;
+      while (!stop.load(std::memory_order_relaxed)) {
+        for (int j = 0; j < 256; j++) {
+          found += map.contains_left(static_cast<int>(gen() % size));
+        }
+        ops += 256;
+      }
+      done[i * 8] = ops + (found == 0);
+    });
+  }
+  std::thread writer([&] {
+    std::mt19937 gen(-1);
+    while (!stop.load(std::memory_order_relaxed)) {
+      int key = static_cast<int>(gen() % size);
+      map.update(key, size + key);
+      map.update(key, key);
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  });
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(millis));
+  stop = true;
+  for (std::thread& curr : threads) {
+    curr.join();
+  }
+  writer.join();
+
+  std::size_t total = 0;
+  for (int i = 0; i < readers; i++) {
+    total += done[i * 8];
+  }
+  return total / (millis * 1000.0);
+}
+} // namespace
+
+int main(int argc, char** argv) {
+  int size = argc > 1 ? std::atoi(argv[1]) : 1000000;
+  int max_threads = argc > 2 ? std::atoi(argv[2])
+                             : static_cast<int>(std::thread::hardware_concurrency());
+  int millis = argc > 3 ? std::atoi(argv[3]) : 1000;
+
+  map_t initial;
+  for (int i = 0; i < size; i++) {
+    initial.insert(i, i);
+  }
+  locked_bimap locked(initial);
+  lr_bimap lr(initial);
+
+  std::printf("readers,shared_mutex Mops/s,left-right Mops/s\n");
+  for (int readers = 1; readers <= std::max(max_threads, 1); readers *= 2) {
+    double a = run(locked, size, readers, millis);
+    double b = run(lr, size, readers, millis);
+    std::printf("%d,%.2f,%.2f\n", readers, a, b);
+  }
+  return 0;
+}
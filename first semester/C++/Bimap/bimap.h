@@ -1,13 +1,21 @@
 #pragma once
 
+#include "node_pool.h"
 #include "treap.h"
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
+#include <iterator>
+#include <memory>
 #include <stdexcept>
 #include <utility>
+#include <vector>
 
 template <typename Left, typename Right, typename CompareLeft = std::less<Left>,
-          typename CompareRight = std::less<Right>>
-struct bimap {
+          typename CompareRight = std::less<Right>,
+          typename Allocator = std::allocator<std::pair<Left, Right>>,
+          typename Stats = tree_inside::no_stats>
+struct bimap : private Stats {
   using left_t = Left;
   using right_t = Right;
 
@@ -19,9 +27,11 @@ struct bimap {
   using left_node_t = tree_inside::elem<Left, tree_inside::left_tag>;
   using right_node_t = tree_inside::elem<Right, tree_inside::right_tag>;
   using left_treap_t =
-      tree_inside::treap<left_t, tree_inside::left_tag, CompareLeft>;
+      tree_inside::treap<left_t, tree_inside::left_tag, CompareLeft, Stats>;
   using right_treap_t =
-      tree_inside::treap<right_t, tree_inside::right_tag, CompareRight>;
+      tree_inside::treap<right_t, tree_inside::right_tag, CompareRight, Stats>;
+  using allocator_type = Allocator;
+  using pool_t = tree_inside::node_pool<node_t, Allocator>;
 
   template <typename value, typename Tag>
   struct iterator {
@@ -87,6 +97,31 @@ struct bimap {
       return *this;
     }
 
+    iterator& operator+=(std::ptrdiff_t n) noexcept {
+      std::size_t index = elem_value->index() + n;
+      elem_value =
+          const_cast<elem_base*>(elem_base::nth(elem_value->fake_node(), index));
+      return *this;
+    }
+
+    iterator& operator-=(std::ptrdiff_t n) noexcept {
+      return *this += -n;
+    }
+
+    friend iterator operator+(iterator it, std::ptrdiff_t n) noexcept {
+      return it += n;
+    }
+
+    friend iterator operator-(iterator it, std::ptrdiff_t n) noexcept {
+      return it -= n;
+    }
+
+    friend std::ptrdiff_t operator-(iterator const& a,
+                                    iterator const& b) noexcept {
+      return static_cast<std::ptrdiff_t>(a.elem_value->index()) -
+             static_cast<std::ptrdiff_t>(b.elem_value->index());
+    }
+
     using tag =
         std::conditional_t<std::is_same_v<Tag, left_tag>, right_tag, left_tag>;
     using t =
@@ -126,30 +161,110 @@ struct bimap {
   using left_iterator = iterator<left_t, left_tag>;
   using right_iterator = iterator<right_t, right_tag>;
 
+  // owns a pair taken out of a bimap, the values can be changed before the
+  // pair is inserted again
+  struct node_type {
+    node_type() noexcept = default;
+
+    node_type(node_type&& other) noexcept
+        : ptr(other.ptr), pool(std::move(other.pool)) {
+      other.ptr = nullptr;
+    }
+
+    node_type& operator=(node_type&& other) noexcept {
+      if (this != &other) {
+        reset();
+        ptr = other.ptr;
+        pool = std::move(other.pool);
+        other.ptr = nullptr;
+      }
+      return *this;
+    }
+
+    ~node_type() {
+      reset();
+    }
+
+    bool empty() const noexcept {
+      return ptr == nullptr;
+    }
+
+    explicit operator bool() const noexcept {
+      return ptr != nullptr;
+    }
+
+    left_t& left() const noexcept {
+      return node_left(ptr)->val;
+    }
+
+    right_t& right() const noexcept {
+      return node_right(ptr)->val;
+    }
+
+    friend bimap;
+
+  private:
+    node_t* ptr{nullptr};
+    std::shared_ptr<pool_t> pool;
+
+    node_type(node_t* ptr_, std::shared_ptr<pool_t> const& pool_) noexcept
+        : ptr(ptr_), pool(pool_) {}
+
+    void reset() noexcept {
+      if (ptr != nullptr) {
+        ptr->~node_t();
+        pool->deallocate(ptr);
+        ptr = nullptr;
+      }
+      pool.reset();
+    }
+  };
+
+  // if the pair is not inserted, node still owns it
+  struct insert_return_type {
+    left_iterator position;
+    bool inserted;
+    node_type node;
+  };
+
   bimap(CompareLeft compare_left = CompareLeft(),
-        CompareRight compare_right = CompareRight()) noexcept
-      : right_treap(std::move(compare_right)),
-        left_treap(std::move(compare_left)) {
+        CompareRight compare_right = CompareRight(),
+        Allocator const& alloc_ = Allocator()) noexcept
+      : alloc(alloc_), left_treap(std::move(compare_left)),
+        right_treap(std::move(compare_right)) {
 
     right_treap.fake.right = &left_treap.fake;
     left_treap.fake.right = &right_treap.fake;
   }
 
   bimap(bimap const& other)
-      : right_treap(static_cast<CompareRight const&>(other.right_treap)),
-        left_treap(static_cast<CompareLeft const&>(other.left_treap)) {
+      : alloc(std::allocator_traits<Allocator>::
+                  select_on_container_copy_construction(other.alloc)),
+        left_treap(static_cast<CompareLeft const&>(other.left_treap)),
+        right_treap(static_cast<CompareRight const&>(other.right_treap)) {
     right_treap.fake.right = &left_treap.fake;
     left_treap.fake.right = &right_treap.fake;
 
-    for (left_iterator left_it = other.begin_left();
-         left_it != other.end_left(); ++left_it) {
-      insert(*left_it, *left_it.flip());
-    }
+    copy_from(other);
+  }
+
+  template <typename InputIt,
+            typename = std::enable_if_t<std::is_base_of_v<
+                std::input_iterator_tag,
+                typename std::iterator_traits<InputIt>::iterator_category>>>
+  bimap(InputIt first, InputIt last, CompareLeft compare_left = CompareLeft(),
+        CompareRight compare_right = CompareRight(),
+        Allocator const& alloc_ = Allocator())
+      : bimap(std::move(compare_left), std::move(compare_right), alloc_) {
+    assign(first, last);
   }
 
   bimap(bimap&& other) noexcept
-      : right_treap(std::move(other.right_treap)), size_(other.size_),
-        left_treap(std::move(other.left_treap)) {}
+      : bimap(static_cast<CompareLeft const&>(other.left_treap),
+              static_cast<CompareRight const&>(other.right_treap),
+              other.alloc) {
+    swap(other);
+  }
 
   bimap& operator=(bimap const& other) {
     if (this != &other) {
@@ -163,13 +278,13 @@ struct bimap {
   bimap& operator=(bimap&& other) noexcept {
     if (this != &other) {
       swap(other);
-      other.erase_left(begin_left(), end_left());
+      other.clear();
     }
     return *this;
   }
 
   ~bimap() {
-    erase_left(begin_left(), end_left());
+    clear();
   }
 
   void swap(bimap& other) noexcept {
@@ -178,24 +293,143 @@ struct bimap {
     left_treap.swap(other.left_treap);
 
     std::swap(size_, other.size_);
+    std::swap(pool, other.pool);
+    std::swap(alloc, other.alloc);
+  }
+
+  void clear() noexcept {
+    if (empty()) {
+      return;
+    }
+
+    bool release = pool.use_count() == 1;
+    if (!release || !std::is_trivially_destructible_v<node_t>) {
+      elem_base* curr = left_treap.fake.left;
+      while (curr != nullptr) {
+        if (curr->left != nullptr) {
+          elem_base* son = curr->left;
+          curr->left = son->right;
+          son->right = curr;
+          curr = son;
+        } else {
+          elem_base* next = curr->right;
+          node_t* ptr = left_base_double(curr);
+          ptr->~node_t();
+          if (!release) {
+            pool->deallocate(ptr);
+          }
+          curr = next;
+        }
+      }
+    }
+
+    if (release) {
+      pool->release();
+    }
+    Stats::deallocated(size_);
+    left_treap.fake.left = nullptr;
+    right_treap.fake.left = nullptr;
+    size_ = 0;
+  }
+
+  // pairs are taken in order, the ones clashing with earlier pairs are skipped
+  template <typename InputIt>
+  void assign(InputIt first, InputIt last) {
+    clear();
+
+    std::vector<node_t*> nodes;
+    try {
+      for (; first != last; ++first) {
+        auto&& value = *first;
+        nodes.push_back(
+            create_node(std::get<0>(std::forward<decltype(value)>(value)),
+                        std::get<1>(std::forward<decltype(value)>(value))));
+      }
+    } catch (...) {
+      for (node_t* ptr : nodes) {
+        destroy_node(ptr);
+      }
+      throw;
+    }
+
+    build(nodes);
+  }
+
+  allocator_type get_allocator() const noexcept {
+    return alloc;
+  }
+
+  CompareLeft key_comp_left() const {
+    return static_cast<CompareLeft const&>(left_treap);
+  }
+
+  CompareRight key_comp_right() const {
+    return static_cast<CompareRight const&>(right_treap);
   }
 
   template <typename left_t_ = left_t, typename right_t_ = right_t>
   left_iterator insert(left_t_&& left, right_t_&& right) {
-    if (right_treap.find(right) != nullptr) {
-      return end_left();
+    return insert_impl(nullptr, nullptr, std::forward<left_t_>(left),
+                       std::forward<right_t_>(right));
+  }
+
+  // amortized O(1) comparisons if the pair goes right before the hint
+  template <typename left_t_ = left_t, typename right_t_ = right_t>
+  left_iterator insert(left_iterator hint, left_t_&& left, right_t_&& right) {
+    return insert_impl(hint.elem_value, nullptr, std::forward<left_t_>(left),
+                       std::forward<right_t_>(right));
+  }
+
+  template <typename left_t_ = left_t, typename right_t_ = right_t>
+  left_iterator insert(left_iterator left_hint, right_iterator right_hint,
+                       left_t_&& left, right_t_&& right) {
+    return insert_impl(left_hint.elem_value, right_hint.elem_value,
+                       std::forward<left_t_>(left),
+                       std::forward<right_t_>(right));
+  }
+
+  // the values are constructed only if the pair is inserted, so the
+  // arguments must be comparable with the stored values as they are
+  template <typename left_t_, typename right_t_>
+  left_iterator try_emplace(left_t_&& left, right_t_&& right) {
+    static_assert(is_lookup_key_v<CompareLeft, left_t, left_t_> &&
+                      is_lookup_key_v<CompareRight, right_t, right_t_>,
+                  "keys of other types need transparent comparators");
+    return insert_impl(nullptr, nullptr, std::forward<left_t_>(left),
+                       std::forward<right_t_>(right));
+  }
+
+  // the node is relinked without allocations if it comes from a bimap which
+  // shares the pool with this one (see share_pool), otherwise the values
+  // move to a new node of this pool; allocators must be equal
+  insert_return_type insert(node_type&& node) {
+    if (node.empty()) {
+      return {end_left(), false, node_type()};
+    }
+
+    node_t* ptr = node.ptr;
+    typename left_treap_t::position left_pos;
+    typename right_treap_t::position right_pos;
+    if (!right_treap.find_position(nullptr, node_right(ptr)->val,
+                                   node_right(ptr)->prior, right_pos) ||
+        !left_treap.find_position(nullptr, node_left(ptr)->val,
+                                  node_left(ptr)->prior, left_pos)) {
+      return {end_left(), false, std::move(node)};
     }
 
-    if (left_treap.find(left) != nullptr) {
-      return end_left();
+    if (pool == node.pool) {
+      node.ptr = nullptr;
+      node.pool.reset();
+      Stats::allocated(1);
+    } else {
+      ptr = take_values(ptr);
+      node.reset();
     }
 
-    auto* curr_node =
-        new node_t(std::forward<left_t_>(left), std::forward<right_t_>(right));
-    elem_base* l_ptr = left_treap.insert(*curr_node);
-    right_treap.insert(*curr_node);
+    elem_base* l_ptr = left_treap.insert_at(left_pos, *ptr);
+    right_treap.insert_at(right_pos, *ptr);
     size_++;
-    return left_iterator(l_ptr);
+    return {left_iterator(l_ptr), true, node_type()};
   }
 
   left_iterator erase_left(left_iterator it) noexcept {
@@ -203,24 +437,20 @@ struct bimap {
     ++copy;
 
     node_t* ptr = left_base_double(it.elem_value);
-
-    right_treap.erase(node_right(ptr));
-    left_treap.erase(it.elem_value);
-
-    size_--;
-    delete ptr;
+    unlink(ptr);
+    destroy_node(ptr);
 
     return copy;
   }
 
   bool erase_left(left_t const& left) noexcept {
-    left_iterator it = find_left(left);
+    return erase_left_key(left);
+  }
 
-    if (it != end_left()) {
-      erase_left(it);
-      return true;
-    }
-    return false;
+  template <typename K, typename C = CompareLeft,
+            typename = typename C::is_transparent>
+  bool erase_left(K const& left) noexcept {
+    return erase_left_key(left);
   }
 
   right_iterator erase_right(right_iterator it) noexcept {
@@ -228,66 +458,218 @@ struct bimap {
     ++copy;
 
     node_t* pointer = right_base_double(it.elem_value);
-
-    right_treap.erase(it.elem_value);
-    left_treap.erase(node_left(pointer));
-
-    size_--;
-    delete pointer;
+    unlink(pointer);
+    destroy_node(pointer);
 
     return copy;
   }
 
   bool erase_right(right_t const& right) noexcept {
-    right_iterator it = find_right(right);
+    return erase_right_key(right);
+  }
 
-    if (it != end_right()) {
-      erase_right(it);
-      return true;
-    }
-    return false;
+  template <typename K, typename C = CompareRight,
+            typename = typename C::is_transparent>
+  bool erase_right(K const& right) noexcept {
+    return erase_right_key(right);
   }
 
   left_iterator erase_left(left_iterator first, left_iterator last) noexcept {
-    while (first != last) {
-      erase_left(first++);
-    }
-    return first;
+    erase_range<left_tag>(first.elem_value, last.elem_value);
+    return last;
   }
 
   right_iterator erase_right(right_iterator first,
                              right_iterator last) noexcept {
-    while (first != last) {
-      erase_right(first++);
+    erase_range<right_tag>(first.elem_value, last.elem_value);
+    return last;
+  }
+
+  // takes [first, last) out into a new bimap with a node pool of its own,
+  // the pairs are moved (or copied, if moving may throw) to its nodes;
+  // O(log n + k log k) on the left side, O(k log n) or O(n) on the right one
+  bimap extract_left(left_iterator first, left_iterator last) {
+    return extract_range<left_tag>(first.elem_value, last.elem_value);
+  }
+
+  bimap extract_right(right_iterator first, right_iterator last) {
+    return extract_range<right_tag>(first.elem_value, last.elem_value);
+  }
+
+  node_type extract_left(left_iterator it) noexcept {
+    node_t* ptr = left_base_double(it.elem_value);
+    unlink(ptr);
+    Stats::deallocated(1);
+    return node_type(ptr, pool);
+  }
+
+  node_type extract_left(left_t const& left) noexcept {
+    return extract_left_key(left);
+  }
+
+  template <typename K, typename C = CompareLeft,
+            typename = typename C::is_transparent>
+  node_type extract_left(K const& left) noexcept {
+    return extract_left_key(left);
+  }
+
+  node_type extract_right(right_iterator it) noexcept {
+    node_t* ptr = right_base_double(it.elem_value);
+    unlink(ptr);
+    Stats::deallocated(1);
+    return node_type(ptr, pool);
+  }
+
+  node_type extract_right(right_t const& right) noexcept {
+    return extract_right_key(right);
+  }
+
+  template <typename K, typename C = CompareRight,
+            typename = typename C::is_transparent>
+  node_type extract_right(K const& right) noexcept {
+    return extract_right_key(right);
+  }
+
+  // this must be empty; after it pairs move between the two bimaps without
+  // allocations, and the two must not be changed from different threads at
+  // once
+  void share_pool(bimap& other) {
+    clear();
+    other.get_pool();
+    pool = other.pool;
+  }
+
+  // moves the pairs of other whose left and right are both absent here,
+  // the rest stay in other; the comparators must give the same order.
+  // If the two share the pool (see share_pool), no node is allocated or
+  // copied, otherwise the values move to new nodes of this pool. The pairs
+  // are picked by two lookups each and sorted by the right values, O(m log n
+  // + m log m) on one thread; only the join of the trees is O(m log(n/m + 1))
+  void splice(bimap& other) {
+    if (this == &other || other.empty()) {
+      return;
+    }
+    if (pool != other.pool) {
+      splice_one_by_one(other);
+      return;
+    }
+
+    std::vector<node_t*> by_left;
+    for (left_iterator left_it = other.begin_left();
+         left_it != other.end_left(); ++left_it) {
+      if (left_treap.find(*left_it) == nullptr &&
+          right_treap.find(*left_it.flip()) == nullptr) {
+        by_left.push_back(left_base_double(left_it.elem_value));
+      }
+    }
+    if (by_left.empty()) {
+      return;
+    }
+
+    std::vector<node_t*> by_right(by_left);
+    if (!other.detach_all(by_left, by_right)) {
+      for (node_t* ptr : by_left) {
+        other.unlink(ptr);
+      }
+      std::sort(by_right.begin(), by_right.end(),
+                [this](node_t* x, node_t* y) { return less_right(x, y); });
+    }
+    other.Stats::deallocated(by_left.size());
+    Stats::allocated(by_left.size());
+    add_sorted(by_left, by_right);
+  }
+
+  // copies the pairs of other whose left and right are both absent here;
+  // as in splice, picking and sorting them is O(m log n + m log m) on one
+  // thread and only the join of the trees is O(m log(n/m + 1))
+  void merge_from(bimap const& other) {
+    if (this == &other) {
+      return;
+    }
+
+    std::vector<node_t*> added;
+    try {
+      for (left_iterator left_it = other.begin_left();
+           left_it != other.end_left(); ++left_it) {
+        if (left_treap.find(*left_it) == nullptr &&
+            right_treap.find(*left_it.flip()) == nullptr) {
+          added.push_back(create_node(*left_it, *left_it.flip()));
+        }
+      }
+    } catch (...) {
+      for (node_t* ptr : added) {
+        destroy_node(ptr);
+      }
+      throw;
+    }
+
+    left_treap_t left_added(static_cast<CompareLeft const&>(left_treap));
+    left_added.build(added.begin(), added.end());
+    std::sort(added.begin(), added.end(), [this](node_t* x, node_t* y) {
+      return less_right(x, y);
+    });
+    right_treap_t right_added(static_cast<CompareRight const&>(right_treap));
+    right_added.build(added.begin(), added.end());
+
+    left_treap.unite(left_added);
+    right_treap.unite(right_added);
+    size_ += added.size();
+  }
+
+  // keeps only the pairs which are in other too
+  void intersect(bimap const& other) noexcept {
+    if (this != &other) {
+      filter(other, false);
+    }
+  }
+
+  // erases the pairs which are in other
+  void subtract(bimap const& other) noexcept {
+    if (this == &other) {
+      clear();
+    } else {
+      filter(other, true);
     }
-    return first;
   }
 
   left_iterator find_left(left_t const& left) const noexcept {
-    elem_base* ptr = left_treap.find(left);
-    return ptr != nullptr ? left_iterator(ptr) : end_left();
+    return find_left_key(left);
+  }
+
+  template <typename K, typename C = CompareLeft,
+            typename = typename C::is_transparent>
+  left_iterator find_left(K const& left) const noexcept {
+    return find_left_key(left);
   }
 
   right_iterator find_right(right_t const& right) const noexcept {
-    elem_base* ptr = right_treap.find(right);
-    return ptr != nullptr ? right_iterator(ptr) : end_right();
+    return find_right_key(right);
   }
 
-  right_t const& at_left(left_t const& key) const {
-    left_iterator it = find_left(key);
+  template <typename K, typename C = CompareRight,
+            typename = typename C::is_transparent>
+  right_iterator find_right(K const& right) const noexcept {
+    return find_right_key(right);
+  }
 
-    if (it == end_left())
-      throw std::out_of_range("no such element");
+  right_t const& at_left(left_t const& key) const {
+    return at_left_key(key);
+  }
 
-    return *it.flip();
+  template <typename K, typename C = CompareLeft,
+            typename = typename C::is_transparent>
+  right_t const& at_left(K const& key) const {
+    return at_left_key(key);
   }
 
   left_t const& at_right(right_t const& key) const {
-    right_iterator it = find_right(key);
+    return at_right_key(key);
+  }
 
-    if (it == end_right())
-      throw std::out_of_range("no such element");
-    return *it.flip();
+  template <typename K, typename C = CompareRight,
+            typename = typename C::is_transparent>
+  left_t const& at_right(K const& key) const {
+    return at_right_key(key);
   }
 
   template <typename = std::enable_if<std::is_default_constructible_v<Right>>>
@@ -333,18 +715,188 @@ struct bimap {
   left_iterator lower_bound_left(const left_t& left) const noexcept {
     return left_iterator(left_treap.lower_bound(left));
   }
+
+  template <typename K, typename C = CompareLeft,
+            typename = typename C::is_transparent>
+  left_iterator lower_bound_left(const K& left) const noexcept {
+    return left_iterator(left_treap.lower_bound(left));
+  }
+
   left_iterator upper_bound_left(const left_t& left) const noexcept {
     return left_iterator(left_treap.upper_bound(left));
   }
 
+  template <typename K, typename C = CompareLeft,
+            typename = typename C::is_transparent>
+  left_iterator upper_bound_left(const K& left) const noexcept {
+    return left_iterator(left_treap.upper_bound(left));
+  }
+
   right_iterator lower_bound_right(const right_t& right) const noexcept {
     return right_iterator(right_treap.lower_bound(right));
   }
 
+  template <typename K, typename C = CompareRight,
+            typename = typename C::is_transparent>
+  right_iterator lower_bound_right(const K& right) const noexcept {
+    return right_iterator(right_treap.lower_bound(right));
+  }
+
   right_iterator upper_bound_right(const right_t& right) const noexcept {
     return right_iterator(right_treap.upper_bound(right));
   }
 
+  template <typename K, typename C = CompareRight,
+            typename = typename C::is_transparent>
+  right_iterator upper_bound_right(const K& right) const noexcept {
+    return right_iterator(right_treap.upper_bound(right));
+  }
+
+  // the searches from finger (an iterator of this bimap) go up from it only
+  // as far as needed, O(log d) expected for the answer d elements away, so
+  // close keys are found faster than from the root
+  template <typename K>
+  left_iterator find_left(left_iterator finger, K const& left) const noexcept {
+    static_assert(is_lookup_key_v<CompareLeft, left_t, K>,
+                  "keys of other types need transparent comparators");
+    elem_base const* ptr = left_treap.lower_bound(finger.elem_value, left);
+    return found<left_tag>(ptr, left) ? left_iterator(ptr) : end_left();
+  }
+
+  template <typename K>
+  left_iterator lower_bound_left(left_iterator finger,
+                                 K const& left) const noexcept {
+    static_assert(is_lookup_key_v<CompareLeft, left_t, K>,
+                  "keys of other types need transparent comparators");
+    return left_iterator(left_treap.lower_bound(finger.elem_value, left));
+  }
+
+  template <typename K>
+  left_iterator upper_bound_left(left_iterator finger,
+                                 K const& left) const noexcept {
+    static_assert(is_lookup_key_v<CompareLeft, left_t, K>,
+                  "keys of other types need transparent comparators");
+    return left_iterator(left_treap.upper_bound(finger.elem_value, left));
+  }
+
+  template <typename K>
+  right_iterator find_right(right_iterator finger,
+                            K const& right) const noexcept {
+    static_assert(is_lookup_key_v<CompareRight, right_t, K>,
+                  "keys of other types need transparent comparators");
+    elem_base const* ptr = right_treap.lower_bound(finger.elem_value, right);
+    return found<right_tag>(ptr, right) ? right_iterator(ptr) : end_right();
+  }
+
+  template <typename K>
+  right_iterator lower_bound_right(right_iterator finger,
+                                   K const& right) const noexcept {
+    static_assert(is_lookup_key_v<CompareRight, right_t, K>,
+                  "keys of other types need transparent comparators");
+    return right_iterator(right_treap.lower_bound(finger.elem_value, right));
+  }
+
+  template <typename K>
+  right_iterator upper_bound_right(right_iterator finger,
+                                   K const& right) const noexcept {
+    static_assert(is_lookup_key_v<CompareRight, right_t, K>,
+                  "keys of other types need transparent comparators");
+    return right_iterator(right_treap.upper_bound(finger.elem_value, right));
+  }
+
+  // finds the keys of [first, last) in one pass: they are sorted and each
+  // one is searched from the place of the previous one, O(m log(n/m + 1))
+  // expected; the i-th result is for the i-th key
+  template <typename ForwardIt>
+  std::vector<left_iterator> find_many_left(ForwardIt first,
+                                            ForwardIt last) const {
+    return find_many<left_tag>(first, last);
+  }
+
+  template <typename ForwardIt>
+  std::vector<right_iterator> find_many_right(ForwardIt first,
+                                              ForwardIt last) const {
+    return find_many<right_tag>(first, last);
+  }
+
+  // finds the keys of [first, last) at once, out[i] gets the iterator for
+  // first[i] (or the end); several walks go on together so that their cache
+  // misses overlap, and large inputs are split between threads, so the
+  // comparator must be safe to call from several threads
+  template <typename RandomIt, typename OutIt>
+  void find_left_bulk(RandomIt first, RandomIt last, OutIt out) const {
+    find_bulk<left_tag>(first, last, out);
+  }
+
+  template <typename RandomIt, typename OutIt>
+  void find_right_bulk(RandomIt first, RandomIt last, OutIt out) const {
+    find_bulk<right_tag>(first, last, out);
+  }
+
+  // out[i] gets the value paired with first[i]; if some key is absent,
+  // std::out_of_range is thrown after the others are written
+  template <typename RandomIt, typename OutIt>
+  void at_left_bulk(RandomIt first, RandomIt last, OutIt out) const {
+    at_bulk<left_tag>(first, last, out);
+  }
+
+  template <typename RandomIt, typename OutIt>
+  void at_right_bulk(RandomIt first, RandomIt last, OutIt out) const {
+    at_bulk<right_tag>(first, last, out);
+  }
+
+  left_iterator nth_left(std::size_t k) const noexcept {
+    return left_iterator(left_treap.nth(k));
+  }
+
+  right_iterator nth_right(std::size_t k) const noexcept {
+    return right_iterator(right_treap.nth(k));
+  }
+
+  // number of left elements less than left
+  std::size_t rank_left(left_t const& left) const noexcept {
+    return left_treap.rank(left);
+  }
+
+  template <typename K, typename C = CompareLeft,
+            typename = typename C::is_transparent>
+  std::size_t rank_left(K const& left) const noexcept {
+    return left_treap.rank(left);
+  }
+
+  std::size_t rank_right(right_t const& right) const noexcept {
+    return right_treap.rank(right);
+  }
+
+  template <typename K, typename C = CompareRight,
+            typename = typename C::is_transparent>
+  std::size_t rank_right(K const& right) const noexcept {
+    return right_treap.rank(right);
+  }
+
+  // number of elements in [from, to)
+  std::size_t count_range_left(left_t const& from,
+                               left_t const& to) const noexcept {
+    return count_range(left_treap, from, to);
+  }
+
+  template <typename K, typename C = CompareLeft,
+            typename = typename C::is_transparent>
+  std::size_t count_range_left(K const& from, K const& to) const noexcept {
+    return count_range(left_treap, from, to);
+  }
+
+  std::size_t count_range_right(right_t const& from,
+                                right_t const& to) const noexcept {
+    return count_range(right_treap, from, to);
+  }
+
+  template <typename K, typename C = CompareRight,
+            typename = typename C::is_transparent>
+  std::size_t count_range_right(K const& from, K const& to) const noexcept {
+    return count_range(right_treap, from, to);
+  }
+
   left_iterator begin_left() const noexcept {
     return left_iterator(left_treap.min());
   }
@@ -369,6 +921,30 @@ struct bimap {
     return size_;
   }
 
+  // nodes which came into this bimap and left it, moved nodes count too
+  Stats const& stats() const noexcept {
+    return *this;
+  }
+
+  // comparisons, split and merge of each side
+  Stats const& left_stats() const noexcept {
+    return left_treap;
+  }
+
+  Stats const& right_stats() const noexcept {
+    return right_treap;
+  }
+
+  // the number of elements at each depth of the treap, its size is the
+  // height; O(n) and no memory but the result
+  std::vector<std::size_t> depth_histogram_left() const {
+    return left_treap.depth_histogram();
+  }
+
+  std::vector<std::size_t> depth_histogram_right() const {
+    return right_treap.depth_histogram();
+  }
+
   friend bool operator==(bimap const& a, bimap const& b) noexcept {
     if (a.size_ != b.size_) {
       return false;
@@ -395,9 +971,720 @@ struct bimap {
 
 private:
   size_t size_{0};
+  Allocator alloc;
+  std::shared_ptr<pool_t> pool;
   left_treap_t left_treap;
   right_treap_t right_treap;
 
+  pool_t& get_pool() {
+    if (pool == nullptr) {
+      pool = std::allocate_shared<pool_t>(alloc, alloc);
+    }
+    return *pool;
+  }
+
+  template <typename... Args>
+  node_t* create_node(Args&&... args) {
+    pool_t& curr_pool = get_pool();
+    void* place = curr_pool.allocate();
+    node_t* res;
+    try {
+      res = new (place) node_t(std::forward<Args>(args)...);
+    } catch (...) {
+      curr_pool.deallocate(place);
+      throw;
+    }
+    Stats::allocated(1);
+    return res;
+  }
+
+  void destroy_node(node_t* ptr) noexcept {
+    ptr->~node_t();
+    pool->deallocate(ptr);
+    Stats::deallocated(1);
+  }
+
+  template <typename Compare, typename T, typename K>
+  static constexpr bool is_lookup_key_v =
+      std::is_same_v<std::decay_t<K>, T> ||
+      tree_inside::is_transparent<Compare>::value;
+
+  // both treaps are searched once, the node is created only after that
+  template <typename left_t_, typename right_t_>
+  left_iterator insert_impl(elem_base* left_hint, elem_base* right_hint,
+                            left_t_&& left, right_t_&& right) {
+    if constexpr (!is_lookup_key_v<CompareLeft, left_t, left_t_>) {
+      return insert_impl(left_hint, right_hint,
+                         left_t(std::forward<left_t_>(left)),
+                         std::forward<right_t_>(right));
+    } else if constexpr (!is_lookup_key_v<CompareRight, right_t, right_t_>) {
+      return insert_impl(left_hint, right_hint, std::forward<left_t_>(left),
+                         right_t(std::forward<right_t_>(right)));
+    } else {
+      uint32_t left_prior = tree_inside::rnd();
+      uint32_t right_prior = tree_inside::rnd();
+      typename left_treap_t::position left_pos;
+      typename right_treap_t::position right_pos;
+
+      if (!right_treap.find_position(right_hint, right, right_prior,
+                                     right_pos) ||
+          !left_treap.find_position(left_hint, left, left_prior, left_pos)) {
+        return end_left();
+      }
+
+      node_t* curr_node =
+          create_node(std::forward<left_t_>(left),
+                      std::forward<right_t_>(right), left_prior, right_prior);
+      elem_base* l_ptr = left_treap.insert_at(left_pos, *curr_node);
+      right_treap.insert_at(right_pos, *curr_node);
+      size_++;
+      return left_iterator(l_ptr);
+    }
+  }
+
+  template <typename K>
+  left_iterator find_left_key(K const& left) const noexcept {
+    elem_base* ptr = left_treap.find(left);
+    return ptr != nullptr ? left_iterator(ptr) : end_left();
+  }
+
+  template <typename K>
+  right_iterator find_right_key(K const& right) const noexcept {
+    elem_base* ptr = right_treap.find(right);
+    return ptr != nullptr ? right_iterator(ptr) : end_right();
+  }
+
+  template <typename K>
+  bool erase_left_key(K const& left) noexcept {
+    left_iterator it = find_left_key(left);
+
+    if (it != end_left()) {
+      erase_left(it);
+      return true;
+    }
+    return false;
+  }
+
+  template <typename K>
+  bool erase_right_key(K const& right) noexcept {
+    right_iterator it = find_right_key(right);
+
+    if (it != end_right()) {
+      erase_right(it);
+      return true;
+    }
+    return false;
+  }
+
+  template <typename K>
+  node_type extract_left_key(K const& left) noexcept {
+    left_iterator it = find_left_key(left);
+    return it != end_left() ? extract_left(it) : node_type();
+  }
+
+  template <typename K>
+  node_type extract_right_key(K const& right) noexcept {
+    right_iterator it = find_right_key(right);
+    return it != end_right() ? extract_right(it) : node_type();
+  }
+
+  void unlink(node_t* ptr) noexcept {
+    right_treap.erase(node_right(ptr));
+    left_treap.erase(node_left(ptr));
+    size_--;
+  }
+
+  // a node of this pool with the values of ptr, they are moved only if that
+  // can't throw, so ptr is intact if there is an exception
+  node_t* take_values(node_t* ptr) {
+    left_node_t* left = node_left(ptr);
+    right_node_t* right = node_right(ptr);
+    if constexpr (std::is_nothrow_move_constructible_v<left_t> &&
+                  std::is_nothrow_move_constructible_v<right_t>) {
+      return create_node(std::move(left->val), std::move(right->val),
+                         left->prior, right->prior);
+    } else {
+      return create_node(std::as_const(left->val), std::as_const(right->val),
+                         left->prior, right->prior);
+    }
+  }
+
+  void splice_one_by_one(bimap& other) {
+    for (left_iterator left_it = other.begin_left();
+         left_it != other.end_left();) {
+      node_t* ptr = left_base_double(left_it.elem_value);
+      ++left_it;
+
+      typename left_treap_t::position left_pos;
+      typename right_treap_t::position right_pos;
+      if (!right_treap.find_position(nullptr, node_right(ptr)->val,
+                                     node_right(ptr)->prior, right_pos) ||
+          !left_treap.find_position(nullptr, node_left(ptr)->val,
+                                    node_left(ptr)->prior, left_pos)) {
+        continue;
+      }
+
+      node_t* curr_node = take_values(ptr);
+      other.unlink(ptr);
+      other.destroy_node(ptr);
+      left_treap.insert_at(left_pos, *curr_node);
+      right_treap.insert_at(right_pos, *curr_node);
+      size_++;
+    }
+  }
+
+  // takes the nodes of by_left (a part of the left order) out of both treaps
+  // by rebuilding them from the rest in O(n), by_right gets the taken nodes
+  // in the right order; false if erasing them one by one is cheaper or there
+  // is no memory
+  bool detach_all(std::vector<node_t*> const& by_left,
+                  std::vector<node_t*>& by_right) noexcept {
+    if (by_left.size() * 4 < size_) {
+      return false;
+    }
+
+    std::vector<node_t*> kept_left;
+    std::vector<node_t*> kept_right;
+    try {
+      kept_left.reserve(size_ - by_left.size());
+      kept_right.reserve(size_ - by_left.size());
+    } catch (...) {
+      return false;
+    }
+
+    auto taken = by_left.begin();
+    for (left_iterator left_it = begin_left(); left_it != end_left();
+         ++left_it) {
+      node_t* ptr = left_base_double(left_it.elem_value);
+      if (taken != by_left.end() && *taken == ptr) {
+        ++taken;
+      } else {
+        kept_left.push_back(ptr);
+      }
+    }
+
+    for (node_t* ptr : by_left) {
+      node_left(ptr)->parent = nullptr;
+    }
+    by_right.clear();
+    for (right_iterator right_it = begin_right(); right_it != end_right();
+         ++right_it) {
+      node_t* ptr = right_base_double(right_it.elem_value);
+      if (node_left(ptr)->parent == nullptr) {
+        by_right.push_back(ptr);
+      } else {
+        kept_right.push_back(ptr);
+      }
+    }
+
+    left_treap.fake.left = nullptr;
+    right_treap.fake.left = nullptr;
+    left_treap.build(kept_left.begin(), kept_left.end());
+    right_treap.build(kept_right.begin(), kept_right.end());
+    size_ -= by_left.size();
+    return true;
+  }
+
+  // the nodes are not in any treap and don't clash with the ones here
+  void add_sorted(std::vector<node_t*> const& by_left,
+                  std::vector<node_t*> const& by_right) noexcept {
+    left_treap_t left_added(static_cast<CompareLeft const&>(left_treap));
+    left_added.build(by_left.begin(), by_left.end());
+    right_treap_t right_added(static_cast<CompareRight const&>(right_treap));
+    right_added.build(by_right.begin(), by_right.end());
+
+    left_treap.unite(left_added);
+    right_treap.unite(right_added);
+    size_ += by_left.size();
+  }
+
+  template <typename K>
+  right_t const& at_left_key(K const& key) const {
+    left_iterator it = find_left_key(key);
+
+    if (it == end_left())
+      throw std::out_of_range("no such element");
+
+    return *it.flip();
+  }
+
+  template <typename K>
+  left_t const& at_right_key(K const& key) const {
+    right_iterator it = find_right_key(key);
+
+    if (it == end_right())
+      throw std::out_of_range("no such element");
+    return *it.flip();
+  }
+
+  template <typename treap_t, typename K>
+  static std::size_t count_range(treap_t const& curr_treap, K const& from,
+                                 K const& to) noexcept {
+    std::size_t to_rank = curr_treap.rank(to);
+    std::size_t from_rank = curr_treap.rank(from);
+    return from_rank < to_rank ? to_rank - from_rank : 0;
+  }
+
+  // the left treap is split by the keys of other, so the comparator and the
+  // right comparator may be called from several threads at once
+  void filter(bimap const& other, bool subtract) noexcept {
+    tree_inside::removed_list removed;
+    left_treap.filter(
+        other.left_treap, subtract,
+        [this, subtract](left_node_t const* x, left_node_t const* y) {
+          return right_treap.equal(right_val(x), right_val(y)) != subtract;
+        },
+        removed);
+
+    std::size_t count = 0;
+    for (elem_base* ptr = removed.head; ptr != nullptr; ptr = ptr->right) {
+      count++;
+    }
+    detach_other<left_tag>(removed, count, nullptr);
+    destroy_removed<left_tag>(removed);
+    size_ -= count;
+  }
+
+  template <typename Tag>
+  void erase_range(elem_base* first, elem_base* last) noexcept {
+    std::size_t from = first->index();
+    std::size_t to = last->index();
+    if (from >= to) {
+      return;
+    }
+    if (to - from == size_) {
+      clear();
+      return;
+    }
+
+    tree_inside::removed_list removed;
+    std::size_t count = side_treap<Tag>().cut(from, to, removed);
+    detach_other<Tag>(removed, count, nullptr);
+    destroy_removed<Tag>(removed);
+    size_ -= count;
+  }
+
+  // the pairs go to new nodes of the pool of res, so that the two bimaps
+  // share nothing: everything which may throw (the cells, and copying the
+  // values unless moving them can't throw) is done before the range is cut
+  template <typename Tag>
+  bimap extract_range(elem_base* first, elem_base* last) {
+    bimap res(static_cast<CompareLeft const&>(left_treap),
+              static_cast<CompareRight const&>(right_treap), alloc);
+    std::size_t from = first->index();
+    std::size_t to = last->index();
+    if (from >= to) {
+      return res;
+    }
+
+    constexpr bool move_values =
+        std::is_nothrow_move_constructible_v<left_t> &&
+        std::is_nothrow_move_constructible_v<right_t>;
+    std::size_t count = to - from;
+    std::vector<node_t*> by_side;
+    std::vector<node_t*> by_other;
+    by_side.reserve(count);
+    by_other.reserve(count);
+
+    // on an exception the cells go away with the pool of res
+    pool_t& res_pool = res.get_pool();
+    for (std::size_t i = 0; i < count; i++) {
+      by_side.push_back(static_cast<node_t*>(res_pool.allocate()));
+    }
+    if constexpr (!move_values) {
+      std::size_t done = 0;
+      try {
+        for (side_iterator<Tag> it(first); done < count; ++it, done++) {
+          node_t* ptr = side_node<Tag>(it.elem_value);
+          new (by_side[done])
+              node_t(std::as_const(node_left(ptr)->val),
+                     std::as_const(node_right(ptr)->val),
+                     node_left(ptr)->prior, node_right(ptr)->prior);
+        }
+      } catch (...) {
+        for (std::size_t i = 0; i < done; i++) {
+          by_side[i]->~node_t();
+        }
+        throw;
+      }
+    }
+
+    tree_inside::removed_list removed;
+    side_treap<Tag>().cut(from, to, removed);
+    detach_other<Tag>(removed, count, nullptr);
+    if constexpr (move_values) {
+      std::size_t i = 0;
+      for (elem_base* ptr = removed.head; ptr != nullptr; ptr = ptr->right) {
+        node_t* curr_node = side_node<Tag>(ptr);
+        new (by_side[i++])
+            node_t(std::move(node_left(curr_node)->val),
+                   std::move(node_right(curr_node)->val),
+                   node_left(curr_node)->prior, node_right(curr_node)->prior);
+      }
+    }
+    destroy_removed<Tag>(removed);
+    size_ -= count;
+
+    by_other.assign(by_side.begin(), by_side.end());
+    std::sort(by_other.begin(), by_other.end(),
+              [this](node_t* x, node_t* y) {
+                if constexpr (std::is_same_v<Tag, left_tag>) {
+                  return less_right(x, y);
+                } else {
+                  return less_left(x, y);
+                }
+              });
+    res.side_treap<Tag>().build(by_side.begin(), by_side.end());
+    res.other_treap<Tag>().build(by_other.begin(), by_other.end());
+    res.size_ = count;
+    res.Stats::allocated(count);
+    return res;
+  }
+
+  // the nodes of removed are already out of the Tag treap and have no parent
+  // there; by_other (if any) gets them in the order of the other treap
+  template <typename Tag>
+  void detach_other(tree_inside::removed_list const& removed,
+                    std::size_t count,
+                    std::vector<node_t*>* by_other) noexcept {
+    // erasing one by one costs O(k log n), rebuilding costs O(n)
+    if (count * 4 >= size_ && rebuild_other<Tag>(count, by_other)) {
+      return;
+    }
+
+    for (elem_base* ptr = removed.head; ptr != nullptr; ptr = ptr->right) {
+      node_t* curr_node = side_node<Tag>(ptr);
+      other_treap<Tag>().erase(other_base<Tag>(curr_node));
+      if (by_other != nullptr) {
+        by_other->push_back(curr_node);
+      }
+    }
+    if (by_other != nullptr) {
+      std::sort(by_other->begin(), by_other->end(),
+                [this](node_t* x, node_t* y) {
+                  if constexpr (std::is_same_v<Tag, left_tag>) {
+                    return less_right(x, y);
+                  } else {
+                    return less_left(x, y);
+                  }
+                });
+    }
+  }
+
+  template <typename Tag>
+  bool rebuild_other(std::size_t count,
+                     std::vector<node_t*>* by_other) noexcept {
+    std::vector<node_t*> kept;
+    try {
+      kept.reserve(size_ - count);
+    } catch (...) {
+      return false;
+    }
+
+    auto& curr_treap = other_treap<Tag>();
+    elem_base* ptr = const_cast<elem_base*>(curr_treap.min());
+    for (other_iterator<Tag> it(ptr); it != other_iterator<Tag>(&curr_treap.fake);
+         ++it) {
+      node_t* curr_node = other_node<Tag>(it.elem_value);
+      if (side_base<Tag>(curr_node)->parent != nullptr) {
+        kept.push_back(curr_node);
+      } else if (by_other != nullptr) {
+        by_other->push_back(curr_node);
+      }
+    }
+    curr_treap.fake.left = nullptr;
+    curr_treap.build(kept.begin(), kept.end());
+    return true;
+  }
+
+  template <typename Tag>
+  void destroy_removed(tree_inside::removed_list const& removed) noexcept {
+    for (elem_base* ptr = removed.head; ptr != nullptr;) {
+      elem_base* next = ptr->right;
+      destroy_node(side_node<Tag>(ptr));
+      ptr = next;
+    }
+  }
+
+  template <typename Tag>
+  using other_iterator = std::conditional_t<std::is_same_v<Tag, left_tag>,
+                                            right_iterator, left_iterator>;
+
+  template <typename Tag>
+  using side_iterator = std::conditional_t<std::is_same_v<Tag, left_tag>,
+                                           left_iterator, right_iterator>;
+
+  template <typename Tag>
+  auto& side_treap() noexcept {
+    if constexpr (std::is_same_v<Tag, left_tag>) {
+      return left_treap;
+    } else {
+      return right_treap;
+    }
+  }
+
+  template <typename Tag>
+  auto const& side_treap() const noexcept {
+    if constexpr (std::is_same_v<Tag, left_tag>) {
+      return left_treap;
+    } else {
+      return right_treap;
+    }
+  }
+
+  // ptr is a lower bound of key
+  template <typename Tag, typename K>
+  bool found(elem_base const* ptr, K const& key) const noexcept {
+    auto const& curr_treap = side_treap<Tag>();
+    return ptr != &curr_treap.fake &&
+           !curr_treap.less(key, *side_iterator<Tag>(ptr));
+  }
+
+  template <typename Tag, typename ForwardIt>
+  std::vector<side_iterator<Tag>> find_many(ForwardIt first,
+                                            ForwardIt last) const {
+    auto const& curr_treap = side_treap<Tag>();
+    std::vector<ForwardIt> keys;
+    for (; first != last; ++first) {
+      keys.push_back(first);
+    }
+
+    std::vector<std::size_t> order(keys.size());
+    for (std::size_t i = 0; i < order.size(); i++) {
+      order[i] = i;
+    }
+    std::sort(order.begin(), order.end(),
+              [&curr_treap, &keys](std::size_t x, std::size_t y) {
+                return curr_treap.less(*keys[x], *keys[y]);
+              });
+
+    std::vector<side_iterator<Tag>> res(
+        keys.size(), side_iterator<Tag>(&curr_treap.fake));
+    elem_base const* finger = &curr_treap.fake;
+    for (std::size_t i : order) {
+      finger = curr_treap.lower_bound(finger, *keys[i]);
+      if (finger == &curr_treap.fake) {
+        break;
+      }
+      if (found<Tag>(finger, *keys[i])) {
+        res[i] = side_iterator<Tag>(finger);
+      }
+    }
+    return res;
+  }
+
+  template <typename Tag, typename RandomIt>
+  static constexpr bool is_side_key_v =
+      std::is_same_v<Tag, left_tag>
+          ? is_lookup_key_v<CompareLeft, left_t,
+                            typename std::iterator_traits<RandomIt>::value_type>
+          : is_lookup_key_v<
+                CompareRight, right_t,
+                typename std::iterator_traits<RandomIt>::value_type>;
+
+  template <typename Tag, typename RandomIt, typename OutIt>
+  void find_bulk(RandomIt first, RandomIt last, OutIt out) const {
+    static_assert(is_side_key_v<Tag, RandomIt>,
+                  "keys of other types need transparent comparators");
+    auto const& curr_treap = side_treap<Tag>();
+    curr_treap.find_bulk(
+        first, static_cast<std::size_t>(last - first),
+        [&curr_treap, out](std::size_t i, elem_base const* ptr) {
+          out[i] =
+              side_iterator<Tag>(ptr != nullptr ? ptr : &curr_treap.fake);
+        });
+  }
+
+  template <typename Tag, typename RandomIt, typename OutIt>
+  void at_bulk(RandomIt first, RandomIt last, OutIt out) const {
+    static_assert(is_side_key_v<Tag, RandomIt>,
+                  "keys of other types need transparent comparators");
+    std::atomic<bool> missing{false};
+    side_treap<Tag>().find_bulk(
+        first, static_cast<std::size_t>(last - first),
+        [&missing, out](std::size_t i, elem_base const* ptr) {
+          if (ptr == nullptr) {
+            missing.store(true, std::memory_order_relaxed);
+          } else {
+            out[i] = *side_iterator<Tag>(ptr).flip();
+          }
+        });
+    if (missing.load(std::memory_order_relaxed)) {
+      throw std::out_of_range("no such element");
+    }
+  }
+
+  template <typename Tag>
+  auto& other_treap() noexcept {
+    if constexpr (std::is_same_v<Tag, left_tag>) {
+      return right_treap;
+    } else {
+      return left_treap;
+    }
+  }
+
+  template <typename Tag>
+  static node_t* side_node(elem_base* base) noexcept {
+    if constexpr (std::is_same_v<Tag, left_tag>) {
+      return left_base_double(base);
+    } else {
+      return right_base_double(base);
+    }
+  }
+
+  template <typename Tag>
+  static node_t* other_node(elem_base* base) noexcept {
+    if constexpr (std::is_same_v<Tag, left_tag>) {
+      return right_base_double(base);
+    } else {
+      return left_base_double(base);
+    }
+  }
+
+  template <typename Tag>
+  static elem_base* side_base(node_t* curr_node) noexcept {
+    if constexpr (std::is_same_v<Tag, left_tag>) {
+      return node_left(curr_node);
+    } else {
+      return node_right(curr_node);
+    }
+  }
+
+  template <typename Tag>
+  static elem_base* other_base(node_t* curr_node) noexcept {
+    if constexpr (std::is_same_v<Tag, left_tag>) {
+      return node_right(curr_node);
+    } else {
+      return node_left(curr_node);
+    }
+  }
+
+  static right_t const& right_val(left_node_t const* left) noexcept {
+    return static_cast<right_node_t const*>(static_cast<node_t const*>(left))
+        ->val;
+  }
+
+  static void reset_links(node_t* ptr) noexcept {
+    for (elem_base* base : {static_cast<elem_base*>(node_left(ptr)),
+                            static_cast<elem_base*>(node_right(ptr))}) {
+      base->left = base->right = base->parent = nullptr;
+      base->size = 1;
+    }
+  }
+
+  bool less_left(node_t* x, node_t* y) const noexcept {
+    return left_treap.less(node_left(x)->val, node_left(y)->val);
+  }
+
+  bool less_right(node_t* x, node_t* y) const noexcept {
+    return right_treap.less(node_right(x)->val, node_right(y)->val);
+  }
+
+  // takes the ownership of the nodes, the treaps must be empty
+  void build(std::vector<node_t*>& nodes) noexcept {
+    std::vector<node_t*> sorted(nodes);
+    auto by_left = [this](node_t* x, node_t* y) { return less_left(x, y); };
+    auto by_right = [this](node_t* x, node_t* y) { return less_right(x, y); };
+    auto not_less_left = [this](node_t* x, node_t* y) {
+      return !less_left(x, y);
+    };
+    auto not_less_right = [this](node_t* x, node_t* y) {
+      return !less_right(x, y);
+    };
+
+    if (!std::is_sorted(sorted.begin(), sorted.end(), by_left)) {
+      std::sort(sorted.begin(), sorted.end(), by_left);
+    }
+    if (std::adjacent_find(sorted.begin(), sorted.end(), not_less_left) !=
+        sorted.end()) {
+      build_one_by_one(nodes);
+      return;
+    }
+    left_treap.build(sorted.begin(), sorted.end());
+
+    std::sort(sorted.begin(), sorted.end(), by_right);
+    if (std::adjacent_find(sorted.begin(), sorted.end(), not_less_right) !=
+        sorted.end()) {
+      left_treap.fake.left = nullptr;
+      build_one_by_one(nodes);
+      return;
+    }
+    right_treap.build(sorted.begin(), sorted.end());
+
+    size_ = nodes.size();
+  }
+
+  void build_one_by_one(std::vector<node_t*>& nodes) noexcept {
+    for (node_t* ptr : nodes) {
+      reset_links(ptr);
+      if (left_treap.find(node_left(ptr)->val) != nullptr ||
+          right_treap.find(node_right(ptr)->val) != nullptr) {
+        destroy_node(ptr);
+        continue;
+      }
+
+      left_treap.insert(*ptr);
+      right_treap.insert(*ptr);
+      size_++;
+    }
+  }
+
+  // other is already sorted on both sides, so no comparisons are needed:
+  // right order of the copies is found by matching the original nodes,
+  // sorted by address in linear time
+  void copy_from(bimap const& other) {
+    using match_t = std::pair<std::uintptr_t, std::size_t>;
+    auto address = [](node_t const* ptr) {
+      return reinterpret_cast<std::uintptr_t>(ptr);
+    };
+    std::vector<node_t*> by_left;
+    std::vector<match_t> left_order;
+    std::vector<match_t> right_order;
+    by_left.reserve(other.size_);
+    left_order.reserve(other.size_);
+    right_order.reserve(other.size_);
+
+    try {
+      for (left_iterator left_it = other.begin_left();
+           left_it != other.end_left(); ++left_it) {
+        left_order.emplace_back(address(left_base_double(left_it.elem_value)),
+                                by_left.size());
+        by_left.push_back(create_node(*left_it, *left_it.flip()));
+      }
+    } catch (...) {
+      for (node_t* ptr : by_left) {
+        destroy_node(ptr);
+      }
+      throw;
+    }
+
+    for (right_iterator right_it = other.begin_right();
+         right_it != other.end_right(); ++right_it) {
+      right_order.emplace_back(address(right_base_double(right_it.elem_value)),
+                               right_order.size());
+    }
+
+    std::vector<node_t*> by_right(other.size_);
+    auto same_node = [](match_t const& x, match_t const& y) {
+      return x.first == y.first;
+    };
+    if (std::equal(left_order.begin(), left_order.end(), right_order.begin(),
+                   same_node)) {
+      by_right = by_left;
+    } else {
+      tree_inside::sort_by_address(left_order);
+      tree_inside::sort_by_address(right_order);
+
+      for (std::size_t i = 0; i < other.size_; i++) {
+        by_right[right_order[i].second] = by_left[left_order[i].second];
+      }
+    }
+
+    left_treap.build(by_left.begin(), by_left.end());
+    right_treap.build(by_right.begin(), by_right.end());
+    size_ = other.size_;
+  }
+
   static node_t* left_base_double(elem_base* left) noexcept {
     return static_cast<node_t*>(static_cast<left_node_t*>(left));
   }
@@ -0,0 +1,1158 @@
+#pragma once
+
+#include "node_pool.h"
+#include "treap.h"
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+namespace tree_inside {
+
+// the leaves of both sides which hold the values of a pair,
+// the places in the leaves are found by a scan
+struct btree_pair {
+  void* leaf[2]{nullptr, nullptr};
+};
+
+// one side of btree_bimap: a B+-tree with the keys of a node stored
+// together in a few cache lines, linked leaves and separators copied into
+// the inner nodes (before anything changes, as copying a key may throw);
+// the leaves point to the shared pairs, which point back to the leaves
+template <typename T, typename Compare, std::size_t Side, typename Allocator>
+struct btree : Compare {
+  static constexpr std::size_t NODE_BYTES = 256;
+  static constexpr std::size_t CAPACITY =
+      NODE_BYTES / (sizeof(T) + sizeof(void*)) < 4
+          ? 4
+          : NODE_BYTES / (sizeof(T) + sizeof(void*));
+  static constexpr std::size_t MIN_COUNT = CAPACITY / 2;
+  static constexpr std::size_t MAX_DEPTH = 64;
+
+  struct node {
+    explicit node(bool is_leaf_) noexcept : is_leaf(is_leaf_) {}
+
+    T* keys() noexcept {
+      return std::launder(reinterpret_cast<T*>(storage));
+    }
+
+    T const* keys() const noexcept {
+      return std::launder(reinterpret_cast<T const*>(storage));
+    }
+
+    std::size_t count{0};
+    bool is_leaf;
+    alignas(T) unsigned char storage[CAPACITY * sizeof(T)];
+  };
+
+  struct leaf : node {
+    leaf() noexcept : node(true) {}
+
+    leaf* prev{nullptr};
+    leaf* next{nullptr};
+    btree_pair* pairs[CAPACITY];
+  };
+
+  // keys[i] separates children[i] (less) and children[i + 1]
+  struct inner : node {
+    inner() noexcept : node(false) {}
+
+    node* children[CAPACITY + 1];
+  };
+
+  // at == nullptr is the end
+  struct position {
+    leaf* at;
+    std::size_t slot;
+
+    bool operator==(position const& other) const noexcept {
+      return at == other.at && slot == other.slot;
+    }
+  };
+
+  struct path {
+    inner* nodes[MAX_DEPTH];
+    std::size_t index[MAX_DEPTH];
+    std::size_t depth{0};
+    leaf* target{nullptr};
+    std::size_t slot{0};
+  };
+
+  // the nodes an insertion may need and the separator of the split leaf,
+  // made before anything changes
+  struct spare {
+    leaf* new_leaf{nullptr};
+    inner* new_inner[MAX_DEPTH + 1];
+    std::size_t inner_count{0};
+    std::optional<T> separator;
+  };
+
+  btree(Compare const& cmp, Allocator const& alloc)
+      : Compare(cmp), leaf_alloc(alloc), inner_alloc(alloc) {}
+
+  btree(btree const&) = delete;
+  btree& operator=(btree const&) = delete;
+
+  ~btree() {
+    clear();
+  }
+
+  void swap(btree& other) noexcept {
+    std::swap(static_cast<Compare&>(*this), static_cast<Compare&>(other));
+    std::swap(leaf_alloc, other.leaf_alloc);
+    std::swap(inner_alloc, other.inner_alloc);
+    std::swap(root, other.root);
+    std::swap(first, other.first);
+    std::swap(last, other.last);
+  }
+
+  void clear() noexcept {
+    if (root != nullptr) {
+      destroy(root);
+    }
+    root = nullptr;
+    first = last = nullptr;
+  }
+
+  position begin() const noexcept {
+    return {first, 0};
+  }
+
+  static position next(position pos) noexcept {
+    if (++pos.slot == pos.at->count) {
+      return {pos.at->next, 0};
+    }
+    return pos;
+  }
+
+  position prev(position pos) const noexcept {
+    if (pos.at == nullptr) {
+      return {last, last->count - 1};
+    }
+    if (pos.slot == 0) {
+      return {pos.at->prev, pos.at->prev->count - 1};
+    }
+    return {pos.at, pos.slot - 1};
+  }
+
+  static position locate(btree_pair const* pair) noexcept {
+    leaf* at = static_cast<leaf*>(pair->leaf[Side]);
+    return {at, static_cast<std::size_t>(
+                    std::find(at->pairs, at->pairs + at->count, pair) -
+                    at->pairs)};
+  }
+
+  template <typename K>
+  position lower_bound(K const& x) const noexcept {
+    leaf* at = descend(x, nullptr);
+    return at == nullptr ? position{nullptr, 0}
+                         : normalize({at, lower_slot(at, x)});
+  }
+
+  template <typename K>
+  position upper_bound(K const& x) const noexcept {
+    leaf* at = descend(x, nullptr);
+    return at == nullptr ? position{nullptr, 0}
+                         : normalize({at, upper_slot(at, x)});
+  }
+
+  template <typename K>
+  position find(K const& x) const noexcept {
+    position pos = lower_bound(x);
+    if (pos.at != nullptr && compare(x, pos.at->keys()[pos.slot])) {
+      return {nullptr, 0};
+    }
+    return pos;
+  }
+
+  // false if there is an equal key
+  template <typename K>
+  bool find_insert(K const& x, path& p) const noexcept {
+    p.target = descend(x, &p);
+    if (p.target == nullptr) {
+      return true;
+    }
+    p.slot = lower_slot(p.target, x);
+    return p.slot == p.target->count ||
+           compare(x, p.target->keys()[p.slot]);
+  }
+
+  // the full nodes on the path are split, so each needs a new one; the
+  // first key of the new leaf is the one at CAPACITY / 2 wherever the new
+  // key goes
+  void reserve(path const& p, spare& s) {
+    if (p.target != nullptr && p.target->count < CAPACITY) {
+      return;
+    }
+
+    try {
+      s.new_leaf = make_leaf();
+      if (p.target == nullptr) {
+        return;
+      }
+      s.separator.emplace(p.target->keys()[CAPACITY / 2]);
+      std::size_t d = p.depth;
+      while (d > 0 && p.nodes[d - 1]->count == CAPACITY) {
+        s.new_inner[s.inner_count++] = make_inner();
+        d--;
+      }
+      if (d == 0) {
+        s.new_inner[s.inner_count++] = make_inner();
+      }
+    } catch (...) {
+      release(s);
+      throw;
+    }
+  }
+
+  void release(spare& s) noexcept {
+    if (s.new_leaf != nullptr) {
+      free_leaf(s.new_leaf);
+      s.new_leaf = nullptr;
+    }
+    while (s.inner_count > 0) {
+      free_inner(s.new_inner[--s.inner_count]);
+    }
+    s.separator.reset();
+  }
+
+  position insert_at(path const& p, spare& s, T&& value,
+                     btree_pair* pair) noexcept {
+    leaf* at = p.target;
+    if (at == nullptr) {
+      at = take_leaf(s);
+      root = first = last = at;
+      insert_into_leaf(at, 0, std::move(value), pair);
+      return {at, 0};
+    }
+    if (at->count < CAPACITY) {
+      insert_into_leaf(at, p.slot, std::move(value), pair);
+      return {at, p.slot};
+    }
+
+    leaf* right = take_leaf(s);
+    std::size_t mid = CAPACITY / 2;
+    std::uninitialized_move_n(at->keys() + mid, CAPACITY - mid,
+                              right->keys());
+    std::destroy_n(at->keys() + mid, CAPACITY - mid);
+    std::copy(at->pairs + mid, at->pairs + CAPACITY, right->pairs);
+    right->count = CAPACITY - mid;
+    at->count = mid;
+    for (std::size_t i = 0; i < right->count; i++) {
+      right->pairs[i]->leaf[Side] = right;
+    }
+
+    right->next = at->next;
+    right->prev = at;
+    if (at->next != nullptr) {
+      at->next->prev = right;
+    } else {
+      last = right;
+    }
+    at->next = right;
+
+    position res;
+    if (p.slot <= mid) {
+      insert_into_leaf(at, p.slot, std::move(value), pair);
+      res = {at, p.slot};
+    } else {
+      insert_into_leaf(right, p.slot - mid, std::move(value), pair);
+      res = {right, p.slot - mid};
+    }
+    insert_into_parent(p, p.depth, s, std::move(*s.separator), right);
+    s.separator.reset();
+    return res;
+  }
+
+  // the key must be in the tree
+  template <typename K>
+  void erase(K const& x) noexcept {
+    path p;
+    leaf* at = descend(x, &p);
+    erase_at(p, at, lower_slot(at, x));
+  }
+
+  template <typename X, typename Y>
+  bool compare(X const& x, Y const& y) const noexcept {
+    return static_cast<Compare const&>(*this)(x, y);
+  }
+
+private:
+  using leaf_allocator_t =
+      typename std::allocator_traits<Allocator>::template rebind_alloc<leaf>;
+  using inner_allocator_t =
+      typename std::allocator_traits<Allocator>::template rebind_alloc<inner>;
+  using leaf_traits = std::allocator_traits<leaf_allocator_t>;
+  using inner_traits = std::allocator_traits<inner_allocator_t>;
+
+  leaf_allocator_t leaf_alloc;
+  inner_allocator_t inner_alloc;
+  node* root{nullptr};
+  leaf* first{nullptr};
+  leaf* last{nullptr};
+
+  leaf* make_leaf() {
+    return new (leaf_traits::allocate(leaf_alloc, 1)) leaf();
+  }
+
+  inner* make_inner() {
+    return new (inner_traits::allocate(inner_alloc, 1)) inner();
+  }
+
+  void free_leaf(leaf* at) noexcept {
+    at->~leaf();
+    leaf_traits::deallocate(leaf_alloc, at, 1);
+  }
+
+  void free_inner(inner* at) noexcept {
+    at->~inner();
+    inner_traits::deallocate(inner_alloc, at, 1);
+  }
+
+  static leaf* take_leaf(spare& s) noexcept {
+    leaf* res = s.new_leaf;
+    s.new_leaf = nullptr;
+    return res;
+  }
+
+  static inner* take_inner(spare& s) noexcept {
+    return s.new_inner[--s.inner_count];
+  }
+
+  void destroy(node* curr) noexcept {
+    std::destroy_n(curr->keys(), curr->count);
+    if (curr->is_leaf) {
+      free_leaf(static_cast<leaf*>(curr));
+      return;
+    }
+
+    inner* curr_inner = static_cast<inner*>(curr);
+    for (std::size_t i = 0; i <= curr->count; i++) {
+      destroy(curr_inner->children[i]);
+    }
+    free_inner(curr_inner);
+  }
+
+  template <typename K>
+  std::size_t lower_slot(node const* curr, K const& x) const noexcept {
+    T const* keys = curr->keys();
+    std::size_t from = 0;
+    std::size_t to = curr->count;
+    while (from < to) {
+      std::size_t mid = (from + to) / 2;
+      if (compare(keys[mid], x)) {
+        from = mid + 1;
+      } else {
+        to = mid;
+      }
+    }
+    return from;
+  }
+
+  template <typename K>
+  std::size_t upper_slot(node const* curr, K const& x) const noexcept {
+    T const* keys = curr->keys();
+    std::size_t from = 0;
+    std::size_t to = curr->count;
+    while (from < to) {
+      std::size_t mid = (from + to) / 2;
+      if (!compare(x, keys[mid])) {
+        from = mid + 1;
+      } else {
+        to = mid;
+      }
+    }
+    return from;
+  }
+
+  template <typename K>
+  leaf* descend(K const& x, path* p) const noexcept {
+    node* curr = root;
+    if (p != nullptr) {
+      p->depth = 0;
+    }
+
+    while (curr != nullptr && !curr->is_leaf) {
+      inner* curr_inner = static_cast<inner*>(curr);
+      std::size_t i = upper_slot(curr_inner, x);
+      if (p != nullptr) {
+        p->nodes[p->depth] = curr_inner;
+        p->index[p->depth++] = i;
+      }
+      curr = curr_inner->children[i];
+    }
+    return static_cast<leaf*>(curr);
+  }
+
+  static position normalize(position pos) noexcept {
+    if (pos.slot == pos.at->count) {
+      return {pos.at->next, 0};
+    }
+    return pos;
+  }
+
+  // the keys from slot move one place right, slot is left unconstructed
+  static void open_slot(node* curr, std::size_t slot) noexcept {
+    T* keys = curr->keys();
+    std::size_t count = curr->count;
+    if (slot == count) {
+      return;
+    }
+    new (keys + count) T(std::move(keys[count - 1]));
+    std::move_backward(keys + slot, keys + count - 1, keys + count);
+    keys[slot].~T();
+  }
+
+  // the keys after slot move one place left, count is not changed
+  static void close_slot(node* curr, std::size_t slot) noexcept {
+    T* keys = curr->keys();
+    std::move(keys + slot + 1, keys + curr->count, keys + slot);
+    keys[curr->count - 1].~T();
+  }
+
+  static void insert_into_leaf(leaf* at, std::size_t slot, T&& value,
+                               btree_pair* pair) noexcept {
+    open_slot(at, slot);
+    new (at->keys() + slot) T(std::move(value));
+    std::move_backward(at->pairs + slot, at->pairs + at->count,
+                       at->pairs + at->count + 1);
+    at->pairs[slot] = pair;
+    at->count++;
+    pair->leaf[Side] = at;
+  }
+
+  static void insert_into_inner(inner* at, std::size_t slot, T&& value,
+                                node* child) noexcept {
+    open_slot(at, slot);
+    new (at->keys() + slot) T(std::move(value));
+    std::move_backward(at->children + slot + 1, at->children + at->count + 1,
+                       at->children + at->count + 2);
+    at->children[slot + 1] = child;
+    at->count++;
+  }
+
+  // right_node goes after the node at depth d of the path
+  void insert_into_parent(path const& p, std::size_t d, spare& s, T&& value,
+                          node* right_node) noexcept {
+    if (d == 0) {
+      inner* new_root = take_inner(s);
+      new (new_root->keys()) T(std::move(value));
+      new_root->children[0] = root;
+      new_root->children[1] = right_node;
+      new_root->count = 1;
+      root = new_root;
+      return;
+    }
+
+    inner* parent = p.nodes[d - 1];
+    std::size_t i = p.index[d - 1];
+    if (parent->count < CAPACITY) {
+      insert_into_inner(parent, i, std::move(value), right_node);
+      return;
+    }
+
+    inner* right = take_inner(s);
+    std::size_t mid = CAPACITY / 2;
+    T promoted(std::move(parent->keys()[mid]));
+    std::uninitialized_move_n(parent->keys() + mid + 1, CAPACITY - mid - 1,
+                              right->keys());
+    std::destroy_n(parent->keys() + mid, CAPACITY - mid);
+    std::copy(parent->children + mid + 1, parent->children + CAPACITY + 1,
+              right->children);
+    right->count = CAPACITY - mid - 1;
+    parent->count = mid;
+
+    if (i <= mid) {
+      insert_into_inner(parent, i, std::move(value), right_node);
+    } else {
+      insert_into_inner(right, i - mid - 1, std::move(value), right_node);
+    }
+    insert_into_parent(p, d - 1, s, std::move(promoted), right);
+  }
+
+  void erase_at(path& p, leaf* at, std::size_t slot) noexcept {
+    close_slot(at, slot);
+    std::move(at->pairs + slot + 1, at->pairs + at->count, at->pairs + slot);
+    at->count--;
+
+    if (at == root) {
+      if (at->count == 0) {
+        free_leaf(at);
+        root = first = last = nullptr;
+      }
+      return;
+    }
+    if (at->count < MIN_COUNT) {
+      fix_leaf(p, at);
+    }
+  }
+
+  static void move_entry(leaf* from, std::size_t from_slot, leaf* to,
+                         std::size_t to_slot) noexcept {
+    insert_into_leaf(to, to_slot, std::move(from->keys()[from_slot]),
+                     from->pairs[from_slot]);
+    close_slot(from, from_slot);
+    std::move(from->pairs + from_slot + 1, from->pairs + from->count,
+              from->pairs + from_slot);
+    from->count--;
+  }
+
+  // removes the key at slot and the child after it
+  static void remove_child(inner* at, std::size_t slot) noexcept {
+    close_slot(at, slot);
+    std::move(at->children + slot + 2, at->children + at->count + 1,
+              at->children + slot + 1);
+    at->count--;
+  }
+
+  void merge_leaves(leaf* a, leaf* b) noexcept {
+    std::uninitialized_move_n(b->keys(), b->count, a->keys() + a->count);
+    std::destroy_n(b->keys(), b->count);
+    for (std::size_t i = 0; i < b->count; i++) {
+      a->pairs[a->count + i] = b->pairs[i];
+      b->pairs[i]->leaf[Side] = a;
+    }
+    a->count += b->count;
+    b->count = 0;
+
+    a->next = b->next;
+    if (b->next != nullptr) {
+      b->next->prev = a;
+    } else {
+      last = a;
+    }
+    free_leaf(b);
+  }
+
+  // b and the separator at slot of parent go to the end of a
+  void merge_inner(inner* a, inner* b, inner* parent,
+                   std::size_t slot) noexcept {
+    new (a->keys() + a->count) T(std::move(parent->keys()[slot]));
+    std::uninitialized_move_n(b->keys(), b->count, a->keys() + a->count + 1);
+    std::destroy_n(b->keys(), b->count);
+    std::copy(b->children, b->children + b->count + 1,
+              a->children + a->count + 1);
+    a->count += b->count + 1;
+    b->count = 0;
+    free_inner(b);
+    remove_child(parent, slot);
+  }
+
+  void fix_leaf(path& p, leaf* at) noexcept {
+    inner* parent = p.nodes[p.depth - 1];
+    std::size_t i = p.index[p.depth - 1];
+    leaf* left =
+        i > 0 ? static_cast<leaf*>(parent->children[i - 1]) : nullptr;
+    leaf* right = i < parent->count
+                      ? static_cast<leaf*>(parent->children[i + 1])
+                      : nullptr;
+
+    if (left != nullptr && left->count > MIN_COUNT &&
+        set_separator(parent, i - 1, left->keys()[left->count - 1])) {
+      move_entry(left, left->count - 1, at, 0);
+      return;
+    }
+    if (right != nullptr && right->count > MIN_COUNT &&
+        set_separator(parent, i, right->keys()[1])) {
+      move_entry(right, 0, at, at->count);
+      return;
+    }
+
+    // if copying a separator threw, at may stay less than half full, which
+    // costs balance but not order; it merges at the latest when it is empty
+    leaf* a = left != nullptr ? left : at;
+    leaf* b = left != nullptr ? at : right;
+    if (a->count + b->count > CAPACITY) {
+      return;
+    }
+    merge_leaves(a, b);
+    remove_child(parent, left != nullptr ? i - 1 : i);
+    fix_inner(p, p.depth - 1);
+  }
+
+  // a copy of key becomes the separator at slot of parent, false if the
+  // copy throws (and then nothing is changed)
+  static bool set_separator(inner* parent, std::size_t slot,
+                            T const& key) noexcept {
+    try {
+      T separator(key);
+      parent->keys()[slot] = std::move(separator);
+      return true;
+    } catch (...) {
+      return false;
+    }
+  }
+
+  void fix_inner(path& p, std::size_t d) noexcept {
+    inner* curr = p.nodes[d];
+    if (d == 0) {
+      if (curr->count == 0) {
+        root = curr->children[0];
+        free_inner(curr);
+      }
+      return;
+    }
+    if (curr->count >= MIN_COUNT) {
+      return;
+    }
+
+    inner* parent = p.nodes[d - 1];
+    std::size_t i = p.index[d - 1];
+    inner* left =
+        i > 0 ? static_cast<inner*>(parent->children[i - 1]) : nullptr;
+    inner* right = i < parent->count
+                       ? static_cast<inner*>(parent->children[i + 1])
+                       : nullptr;
+
+    if (left != nullptr && left->count > MIN_COUNT) {
+      insert_into_inner(curr, 0, std::move(parent->keys()[i - 1]),
+                        curr->children[0]);
+      curr->children[0] = left->children[left->count];
+      parent->keys()[i - 1] = std::move(left->keys()[left->count - 1]);
+      left->keys()[left->count - 1].~T();
+      left->count--;
+    } else if (right != nullptr && right->count > MIN_COUNT) {
+      insert_into_inner(curr, curr->count, std::move(parent->keys()[i]),
+                        right->children[0]);
+      parent->keys()[i] = std::move(right->keys()[0]);
+      close_slot(right, 0);
+      std::move(right->children + 1, right->children + right->count + 1,
+                right->children);
+      right->count--;
+    } else {
+      if (left != nullptr) {
+        merge_inner(left, curr, parent, i - 1);
+      } else {
+        merge_inner(curr, right, parent, i);
+      }
+      fix_inner(p, d - 1);
+    }
+  }
+};
+} // namespace tree_inside
+
+// the basic interface of bimap (insert, erase of a pair or a range, find,
+// at, at_*_or_default, bounds, iteration, comparison), but each side is a
+// B+-tree: a lookup touches a few nodes of several keys instead of a long
+// chain of single nodes. Unlike bimap:
+// - iterators are invalidated by insert and erase;
+// - there are no hinted insertion or try_emplace, node handles (extract,
+//   splice), rank queries (nth, rank, count_range), set operations or bulk
+//   and finger lookups
+template <typename Left, typename Right, typename CompareLeft = std::less<Left>,
+          typename CompareRight = std::less<Right>,
+          typename Allocator = std::allocator<std::pair<Left, Right>>>
+struct btree_bimap {
+  using left_t = Left;
+  using right_t = Right;
+  using allocator_type = Allocator;
+
+  static constexpr std::size_t LEFT = 0;
+  static constexpr std::size_t RIGHT = 1;
+
+private:
+  using pair_t = tree_inside::btree_pair;
+  using pool_t = tree_inside::node_pool<pair_t, Allocator>;
+  using left_tree_t = tree_inside::btree<Left, CompareLeft, LEFT, Allocator>;
+  using right_tree_t =
+      tree_inside::btree<Right, CompareRight, RIGHT, Allocator>;
+
+  template <std::size_t side>
+  using tree_t = std::conditional_t<side == LEFT, left_tree_t, right_tree_t>;
+
+public:
+  template <typename value, std::size_t side>
+  struct iterator {
+    using position = typename tree_t<side>::position;
+
+    iterator() = delete;
+
+    iterator(btree_bimap const* owner_, position pos_) noexcept
+        : owner(owner_), pos(pos_) {}
+
+    value const* operator->() const noexcept {
+      return &**this;
+    }
+
+    value const& operator*() const noexcept {
+      return pos.at->keys()[pos.slot];
+    }
+
+    iterator operator--(int) noexcept {
+      iterator res = *this;
+      --(*this);
+      return res;
+    }
+
+    iterator& operator--() noexcept {
+      pos = owner->template tree<side>().prev(pos);
+      return *this;
+    }
+
+    iterator operator++(int) noexcept {
+      iterator res = *this;
+      ++(*this);
+      return res;
+    }
+
+    iterator& operator++() noexcept {
+      pos = tree_t<side>::next(pos);
+      return *this;
+    }
+
+    using t = std::conditional_t<side == LEFT, right_t, left_t>;
+    using curr_it = iterator<t, 1 - side>;
+
+    curr_it flip() const noexcept {
+      if (pos.at == nullptr) {
+        return curr_it(owner, {nullptr, 0});
+      }
+      return curr_it(owner,
+                     tree_t<1 - side>::locate(pos.at->pairs[pos.slot]));
+    }
+
+    bool operator==(iterator const& other) const noexcept {
+      return pos == other.pos;
+    }
+
+    bool operator!=(iterator const& other) const noexcept {
+      return !(*this == other);
+    }
+
+    friend btree_bimap;
+
+  private:
+    btree_bimap const* owner;
+    position pos;
+  };
+
+  using left_iterator = iterator<left_t, LEFT>;
+  using right_iterator = iterator<right_t, RIGHT>;
+
+  btree_bimap(CompareLeft compare_left = CompareLeft(),
+              CompareRight compare_right = CompareRight(),
+              Allocator const& alloc_ = Allocator())
+      : alloc(alloc_), left_tree(compare_left, alloc_),
+        right_tree(compare_right, alloc_) {}
+
+  btree_bimap(btree_bimap const& other)
+      : btree_bimap(static_cast<CompareLeft const&>(other.left_tree),
+                    static_cast<CompareRight const&>(other.right_tree),
+                    std::allocator_traits<Allocator>::
+                        select_on_container_copy_construction(other.alloc)) {
+    for (left_iterator it = other.begin_left(); it != other.end_left();
+         ++it) {
+      insert(*it, *it.flip());
+    }
+  }
+
+  btree_bimap(btree_bimap&& other) noexcept
+      : btree_bimap(static_cast<CompareLeft const&>(other.left_tree),
+                    static_cast<CompareRight const&>(other.right_tree),
+                    other.alloc) {
+    swap(other);
+  }
+
+  btree_bimap& operator=(btree_bimap const& other) {
+    if (this != &other) {
+      btree_bimap tmp(other);
+      swap(tmp);
+    }
+    return *this;
+  }
+
+  btree_bimap& operator=(btree_bimap&& other) noexcept {
+    if (this != &other) {
+      swap(other);
+      other.clear();
+    }
+    return *this;
+  }
+
+  ~btree_bimap() {
+    clear();
+  }
+
+  void swap(btree_bimap& other) noexcept {
+    std::swap(alloc, other.alloc);
+    std::swap(pool, other.pool);
+    left_tree.swap(other.left_tree);
+    right_tree.swap(other.right_tree);
+    std::swap(size_, other.size_);
+  }
+
+  void clear() noexcept {
+    left_tree.clear();
+    right_tree.clear();
+    if (pool != nullptr) {
+      pool->release();
+    }
+    size_ = 0;
+  }
+
+  template <typename left_t_ = left_t, typename right_t_ = right_t>
+  left_iterator insert(left_t_&& left, right_t_&& right) {
+    if constexpr (!is_lookup_key_v<CompareLeft, left_t, left_t_>) {
+      return insert(left_t(std::forward<left_t_>(left)),
+                    std::forward<right_t_>(right));
+    } else if constexpr (!is_lookup_key_v<CompareRight, right_t, right_t_>) {
+      return insert(std::forward<left_t_>(left),
+                    right_t(std::forward<right_t_>(right)));
+    } else {
+      typename left_tree_t::path left_path;
+      typename right_tree_t::path right_path;
+      if (!left_tree.find_insert(left, left_path) ||
+          !right_tree.find_insert(right, right_path)) {
+        return end_left();
+      }
+
+      left_t left_val(std::forward<left_t_>(left));
+      right_t right_val(std::forward<right_t_>(right));
+      typename left_tree_t::spare left_spare;
+      typename right_tree_t::spare right_spare;
+      left_tree.reserve(left_path, left_spare);
+      try {
+        right_tree.reserve(right_path, right_spare);
+      } catch (...) {
+        left_tree.release(left_spare);
+        throw;
+      }
+      pair_t* pair = create_pair(left_spare, right_spare);
+
+      auto res = left_tree.insert_at(left_path, left_spare,
+                                     std::move(left_val), pair);
+      right_tree.insert_at(right_path, right_spare, std::move(right_val),
+                           pair);
+      size_++;
+      return left_iterator(this, res);
+    }
+  }
+
+  left_iterator erase_left(left_iterator it) noexcept {
+    return left_iterator(this, erase_at<LEFT>(it.pos));
+  }
+
+  bool erase_left(left_t const& left) noexcept {
+    return erase_key<LEFT>(left);
+  }
+
+  template <typename K, typename C = CompareLeft,
+            typename = typename C::is_transparent>
+  bool erase_left(K const& left) noexcept {
+    return erase_key<LEFT>(left);
+  }
+
+  right_iterator erase_right(right_iterator it) noexcept {
+    return right_iterator(this, erase_at<RIGHT>(it.pos));
+  }
+
+  bool erase_right(right_t const& right) noexcept {
+    return erase_key<RIGHT>(right);
+  }
+
+  template <typename K, typename C = CompareRight,
+            typename = typename C::is_transparent>
+  bool erase_right(K const& right) noexcept {
+    return erase_key<RIGHT>(right);
+  }
+
+  left_iterator erase_left(left_iterator first, left_iterator last) noexcept {
+    return left_iterator(this, erase_range<LEFT>(first.pos, last.pos));
+  }
+
+  right_iterator erase_right(right_iterator first,
+                             right_iterator last) noexcept {
+    return right_iterator(this, erase_range<RIGHT>(first.pos, last.pos));
+  }
+
+  left_iterator find_left(left_t const& left) const noexcept {
+    return left_iterator(this, left_tree.find(left));
+  }
+
+  template <typename K, typename C = CompareLeft,
+            typename = typename C::is_transparent>
+  left_iterator find_left(K const& left) const noexcept {
+    return left_iterator(this, left_tree.find(left));
+  }
+
+  right_iterator find_right(right_t const& right) const noexcept {
+    return right_iterator(this, right_tree.find(right));
+  }
+
+  template <typename K, typename C = CompareRight,
+            typename = typename C::is_transparent>
+  right_iterator find_right(K const& right) const noexcept {
+    return right_iterator(this, right_tree.find(right));
+  }
+
+  right_t const& at_left(left_t const& key) const {
+    return at_key<LEFT>(key);
+  }
+
+  template <typename K, typename C = CompareLeft,
+            typename = typename C::is_transparent>
+  right_t const& at_left(K const& key) const {
+    return at_key<LEFT>(key);
+  }
+
+  left_t const& at_right(right_t const& key) const {
+    return at_key<RIGHT>(key);
+  }
+
+  template <typename K, typename C = CompareRight,
+            typename = typename C::is_transparent>
+  left_t const& at_right(K const& key) const {
+    return at_key<RIGHT>(key);
+  }
+
+  template <typename = std::enable_if<std::is_default_constructible_v<Right>>>
+  right_t const& at_left_or_default(left_t const& key) {
+    left_iterator left_it = find_left(key);
+    if (left_it != end_left()) {
+      return *left_it.flip();
+    }
+
+    right_t default_right = right_t();
+    right_iterator right_it = find_right(default_right);
+    if (right_it == end_right()) {
+      return *insert(key, std::move(default_right)).flip();
+    }
+
+    pair_t* pair = right_it.pos.at->pairs[right_it.pos.slot];
+    rekey<LEFT>(pair, key);
+    return *right_iterator(this, right_tree_t::locate(pair));
+  }
+
+  template <typename = std::enable_if<std::is_default_constructible_v<Left>>>
+  left_t const& at_right_or_default(right_t const& key) {
+    right_iterator right_it = find_right(key);
+    if (right_it != end_right()) {
+      return *right_it.flip();
+    }
+
+    left_t default_left = left_t();
+    left_iterator left_it = find_left(default_left);
+    if (left_it == end_left()) {
+      return *insert(std::move(default_left), key);
+    }
+
+    pair_t* pair = left_it.pos.at->pairs[left_it.pos.slot];
+    rekey<RIGHT>(pair, key);
+    return *left_iterator(this, left_tree_t::locate(pair));
+  }
+
+  left_iterator lower_bound_left(left_t const& left) const noexcept {
+    return left_iterator(this, left_tree.lower_bound(left));
+  }
+
+  template <typename K, typename C = CompareLeft,
+            typename = typename C::is_transparent>
+  left_iterator lower_bound_left(K const& left) const noexcept {
+    return left_iterator(this, left_tree.lower_bound(left));
+  }
+
+  left_iterator upper_bound_left(left_t const& left) const noexcept {
+    return left_iterator(this, left_tree.upper_bound(left));
+  }
+
+  template <typename K, typename C = CompareLeft,
+            typename = typename C::is_transparent>
+  left_iterator upper_bound_left(K const& left) const noexcept {
+    return left_iterator(this, left_tree.upper_bound(left));
+  }
+
+  right_iterator lower_bound_right(right_t const& right) const noexcept {
+    return right_iterator(this, right_tree.lower_bound(right));
+  }
+
+  template <typename K, typename C = CompareRight,
+            typename = typename C::is_transparent>
+  right_iterator lower_bound_right(K const& right) const noexcept {
+    return right_iterator(this, right_tree.lower_bound(right));
+  }
+
+  right_iterator upper_bound_right(right_t const& right) const noexcept {
+    return right_iterator(this, right_tree.upper_bound(right));
+  }
+
+  template <typename K, typename C = CompareRight,
+            typename = typename C::is_transparent>
+  right_iterator upper_bound_right(K const& right) const noexcept {
+    return right_iterator(this, right_tree.upper_bound(right));
+  }
+
+  left_iterator begin_left() const noexcept {
+    return left_iterator(this, left_tree.begin());
+  }
+
+  left_iterator end_left() const noexcept {
+    return left_iterator(this, {nullptr, 0});
+  }
+
+  right_iterator begin_right() const noexcept {
+    return right_iterator(this, right_tree.begin());
+  }
+
+  right_iterator end_right() const noexcept {
+    return right_iterator(this, {nullptr, 0});
+  }
+
+  bool empty() const noexcept {
+    return size_ == 0;
+  }
+
+  std::size_t size() const noexcept {
+    return size_;
+  }
+
+  allocator_type get_allocator() const noexcept {
+    return alloc;
+  }
+
+  friend bool operator==(btree_bimap const& a, btree_bimap const& b) noexcept {
+    if (a.size_ != b.size_) {
+      return false;
+    }
+
+    left_iterator left_it_b = b.begin_left();
+    for (left_iterator left_it_a = a.begin_left(); left_it_a != a.end_left();
+         ++left_it_a, ++left_it_b) {
+      if (a.left_tree.compare(*left_it_a, *left_it_b) ||
+          a.left_tree.compare(*left_it_b, *left_it_a) ||
+          a.right_tree.compare(*left_it_a.flip(), *left_it_b.flip()) ||
+          a.right_tree.compare(*left_it_b.flip(), *left_it_a.flip())) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  friend bool operator!=(btree_bimap const& a, btree_bimap const& b) noexcept {
+    return !(a == b);
+  }
+
+private:
+  Allocator alloc;
+  std::shared_ptr<pool_t> pool;
+  left_tree_t left_tree;
+  right_tree_t right_tree;
+  std::size_t size_{0};
+
+  template <typename Compare, typename T, typename K>
+  static constexpr bool is_lookup_key_v =
+      std::is_same_v<std::decay_t<K>, T> ||
+      tree_inside::is_transparent<Compare>::value;
+
+  template <std::size_t side>
+  auto& tree() noexcept {
+    if constexpr (side == LEFT) {
+      return left_tree;
+    } else {
+      return right_tree;
+    }
+  }
+
+  template <std::size_t side>
+  auto const& tree() const noexcept {
+    if constexpr (side == LEFT) {
+      return left_tree;
+    } else {
+      return right_tree;
+    }
+  }
+
+  // the spares are given back if there is no memory for the pair
+  pair_t* create_pair(typename left_tree_t::spare& left_spare,
+                      typename right_tree_t::spare& right_spare) {
+    try {
+      if (pool == nullptr) {
+        pool = std::allocate_shared<pool_t>(alloc, alloc);
+      }
+      return new (pool->allocate()) pair_t();
+    } catch (...) {
+      left_tree.release(left_spare);
+      right_tree.release(right_spare);
+      throw;
+    }
+  }
+
+  // the position of the element after the erased one
+  template <std::size_t side, typename position>
+  position erase_at(position pos) noexcept {
+    position next_pos = tree_t<side>::next(pos);
+    pair_t const* next_pair =
+        next_pos.at == nullptr ? nullptr : next_pos.at->pairs[next_pos.slot];
+
+    erase_pair(pos.at->pairs[pos.slot]);
+    return next_pair == nullptr ? position{nullptr, 0}
+                                : tree_t<side>::locate(next_pair);
+  }
+
+  // erasing moves the elements between leaves, so the end of the range is
+  // remembered by its pair
+  template <std::size_t side, typename position>
+  position erase_range(position first, position last) noexcept {
+    pair_t const* last_pair =
+        last.at == nullptr ? nullptr : last.at->pairs[last.slot];
+    while (first.at != nullptr && first.at->pairs[first.slot] != last_pair) {
+      first = erase_at<side>(first);
+    }
+    return first;
+  }
+
+  void erase_pair(pair_t* pair) noexcept {
+    auto left_pos = left_tree_t::locate(pair);
+    auto right_pos = right_tree_t::locate(pair);
+    left_tree.erase(left_pos.at->keys()[left_pos.slot]);
+    right_tree.erase(right_pos.at->keys()[right_pos.slot]);
+    pool->deallocate(pair);
+    size_--;
+  }
+
+  template <std::size_t side, typename K>
+  bool erase_key(K const& val) noexcept {
+    auto pos = tree<side>().find(val);
+    if (pos.at == nullptr) {
+      return false;
+    }
+    erase_pair(pos.at->pairs[pos.slot]);
+    return true;
+  }
+
+  template <std::size_t side, typename K>
+  auto const& at_key(K const& val) const {
+    auto pos = tree<side>().find(val);
+
+    if (pos.at == nullptr)
+      throw std::out_of_range("no such element");
+
+    auto other = tree_t<1 - side>::locate(pos.at->pairs[pos.slot]);
+    return other.at->keys()[other.slot];
+  }
+
+  // the pair gets key (which is not in the tree) on the given side instead
+  // of its old one: everything which may throw, including copying the old
+  // key to erase it by, is done before the new key goes in
+  template <std::size_t side, typename K>
+  void rekey(pair_t* pair, K const& key) {
+    using value_t = std::conditional_t<side == LEFT, left_t, right_t>;
+    auto& curr_tree = tree<side>();
+    auto pos = tree_t<side>::locate(pair);
+    value_t old_value(pos.at->keys()[pos.slot]);
+    value_t value(key);
+    typename tree_t<side>::path curr_path;
+    typename tree_t<side>::spare curr_spare;
+    curr_tree.find_insert(value, curr_path);
+    curr_tree.reserve(curr_path, curr_spare);
+
+    curr_tree.insert_at(curr_path, curr_spare, std::move(value), pair);
+    curr_tree.erase(old_value);
+    // both entries pointed to the pair while they were moved around
+    pair->leaf[side] = curr_tree.find(key).at;
+  }
+};
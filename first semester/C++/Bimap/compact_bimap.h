@@ -0,0 +1,807 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// the basic interface of bimap (insert, erase, find, at, bounds and
+// iteration), but the nodes live in one array and are linked by 32-bit
+// indices; the priority of a node is a hash of its index. Unlike bimap:
+// - an insertion which grows the array moves every pair, so references and
+//   pointers from *it, it-> and at_* are invalidated by it, as with
+//   std::vector (iterators are indices and stay valid);
+// - there are no rank queries (nth, rank), node handles (extract, splice),
+//   hinted insertion, finger search, bulk lookups or set operations
+template <typename Left, typename Right, typename CompareLeft = std::less<Left>,
+          typename CompareRight = std::less<Right>,
+          typename Allocator = std::allocator<std::pair<Left, Right>>>
+struct compact_bimap {
+  using left_t = Left;
+  using right_t = Right;
+  using index_t = std::uint32_t;
+  using allocator_type = Allocator;
+
+  static constexpr index_t NIL = static_cast<index_t>(-1);
+  static constexpr std::size_t LEFT = 0;
+  static constexpr std::size_t RIGHT = 1;
+
+  template <typename value, std::size_t side>
+  struct iterator {
+    iterator() = delete;
+
+    iterator(compact_bimap const* owner_, index_t ind_) noexcept
+        : owner(owner_), ind(ind_) {}
+
+    value const* operator->() const noexcept {
+      return &**this;
+    }
+
+    value const& operator*() const noexcept {
+      return owner->template key<side>(ind);
+    }
+
+    iterator operator--(int) noexcept {
+      iterator res = *this;
+      --(*this);
+      return res;
+    }
+
+    iterator& operator--() noexcept {
+      ind = owner->template prev<side>(ind);
+      return *this;
+    }
+
+    iterator operator++(int) noexcept {
+      iterator res = *this;
+      ++(*this);
+      return res;
+    }
+
+    iterator& operator++() noexcept {
+      ind = owner->template next<side>(ind);
+      return *this;
+    }
+
+    using t = std::conditional_t<side == LEFT, right_t, left_t>;
+    using curr_it = iterator<t, 1 - side>;
+
+    curr_it flip() const noexcept {
+      return curr_it(owner, ind);
+    }
+
+    bool operator==(iterator const& other) const noexcept {
+      return ind == other.ind;
+    }
+
+    bool operator!=(iterator const& other) const noexcept {
+      return !(*this == other);
+    }
+
+    friend compact_bimap;
+
+  private:
+    compact_bimap const* owner;
+    index_t ind;
+  };
+
+  using left_iterator = iterator<left_t, LEFT>;
+  using right_iterator = iterator<right_t, RIGHT>;
+
+  compact_bimap(CompareLeft compare_left = CompareLeft(),
+                CompareRight compare_right = CompareRight(),
+                Allocator const& alloc_ = Allocator()) noexcept
+      : alloc(alloc_), cmp_left(std::move(compare_left)),
+        cmp_right(std::move(compare_right)) {}
+
+  compact_bimap(compact_bimap const& other)
+      : alloc(std::allocator_traits<slot_allocator_t>::
+                  select_on_container_copy_construction(other.alloc)),
+        cmp_left(other.cmp_left), cmp_right(other.cmp_right) {
+    if (other.used == 0) {
+      return;
+    }
+
+    reserve_exact(other.used);
+    index_t constructed = 0;
+    try {
+      for (; constructed < other.used; constructed++) {
+        if (other.live[constructed]) {
+          traits::construct(alloc, &slots[constructed].value,
+                            other.slots[constructed].value);
+        } else {
+          slots[constructed].next_free = other.slots[constructed].next_free;
+        }
+      }
+    } catch (...) {
+      for (index_t i = 0; i < constructed; i++) {
+        if (other.live[i]) {
+          traits::destroy(alloc, &slots[i].value);
+        }
+      }
+      traits::deallocate(alloc, slots, capacity_);
+      throw;
+    }
+
+    live = other.live;
+    used = other.used;
+    free_head = other.free_head;
+    root[LEFT] = other.root[LEFT];
+    root[RIGHT] = other.root[RIGHT];
+    size_ = other.size_;
+  }
+
+  compact_bimap(compact_bimap&& other) noexcept
+      : alloc(other.alloc), cmp_left(other.cmp_left),
+        cmp_right(other.cmp_right) {
+    swap(other);
+  }
+
+  template <typename InputIt,
+            typename = std::enable_if_t<std::is_base_of_v<
+                std::input_iterator_tag,
+                typename std::iterator_traits<InputIt>::iterator_category>>>
+  compact_bimap(InputIt first, InputIt last,
+                CompareLeft compare_left = CompareLeft(),
+                CompareRight compare_right = CompareRight(),
+                Allocator const& alloc_ = Allocator())
+      : compact_bimap(std::move(compare_left), std::move(compare_right),
+                      alloc_) {
+    assign(first, last);
+  }
+
+  compact_bimap& operator=(compact_bimap const& other) {
+    if (this != &other) {
+      compact_bimap tmp(other);
+      swap(tmp);
+    }
+    return *this;
+  }
+
+  compact_bimap& operator=(compact_bimap&& other) noexcept {
+    if (this != &other) {
+      swap(other);
+      other.clear();
+    }
+    return *this;
+  }
+
+  ~compact_bimap() {
+    clear();
+    if (slots != nullptr) {
+      traits::deallocate(alloc, slots, capacity_);
+    }
+  }
+
+  void swap(compact_bimap& other) noexcept {
+    std::swap(alloc, other.alloc);
+    std::swap(cmp_left, other.cmp_left);
+    std::swap(cmp_right, other.cmp_right);
+    std::swap(slots, other.slots);
+    live.swap(other.live);
+    std::swap(used, other.used);
+    std::swap(capacity_, other.capacity_);
+    std::swap(free_head, other.free_head);
+    std::swap(root, other.root);
+    std::swap(size_, other.size_);
+  }
+
+  // keeps the memory, like std::vector::clear
+  void clear() noexcept {
+    if (!std::is_trivially_destructible_v<node>) {
+      for (index_t i = 0; i < used; i++) {
+        if (live[i]) {
+          traits::destroy(alloc, &slots[i].value);
+        }
+      }
+    }
+
+    live.clear();
+    used = 0;
+    free_head = NIL;
+    root[LEFT] = root[RIGHT] = NIL;
+    size_ = 0;
+  }
+
+  template <typename InputIt>
+  void assign(InputIt first, InputIt last) {
+    clear();
+    for (; first != last; ++first) {
+      auto&& value = *first;
+      insert(std::get<0>(std::forward<decltype(value)>(value)),
+             std::get<1>(std::forward<decltype(value)>(value)));
+    }
+  }
+
+  void reserve(std::size_t count) {
+    if (count > capacity_) {
+      reserve_exact(count);
+    }
+  }
+
+  template <typename left_t_ = left_t, typename right_t_ = right_t>
+  left_iterator insert(left_t_&& left, right_t_&& right) {
+    if (find<RIGHT>(right) != NIL || find<LEFT>(left) != NIL) {
+      return end_left();
+    }
+
+    index_t ind = create_node(std::forward<left_t_>(left),
+                              std::forward<right_t_>(right));
+    insert_node<LEFT>(ind);
+    insert_node<RIGHT>(ind);
+    size_++;
+    return left_iterator(this, ind);
+  }
+
+  left_iterator erase_left(left_iterator it) noexcept {
+    left_iterator copy = it;
+    ++copy;
+    erase_node(it.ind);
+    return copy;
+  }
+
+  bool erase_left(left_t const& left) noexcept {
+    return erase_key<LEFT>(left);
+  }
+
+  template <typename K, typename C = CompareLeft,
+            typename = typename C::is_transparent>
+  bool erase_left(K const& left) noexcept {
+    return erase_key<LEFT>(left);
+  }
+
+  right_iterator erase_right(right_iterator it) noexcept {
+    right_iterator copy = it;
+    ++copy;
+    erase_node(it.ind);
+    return copy;
+  }
+
+  bool erase_right(right_t const& right) noexcept {
+    return erase_key<RIGHT>(right);
+  }
+
+  template <typename K, typename C = CompareRight,
+            typename = typename C::is_transparent>
+  bool erase_right(K const& right) noexcept {
+    return erase_key<RIGHT>(right);
+  }
+
+  left_iterator erase_left(left_iterator first, left_iterator last) noexcept {
+    while (first != last) {
+      erase_left(first++);
+    }
+    return first;
+  }
+
+  right_iterator erase_right(right_iterator first,
+                             right_iterator last) noexcept {
+    while (first != last) {
+      erase_right(first++);
+    }
+    return first;
+  }
+
+  left_iterator find_left(left_t const& left) const noexcept {
+    return left_iterator(this, find<LEFT>(left));
+  }
+
+  template <typename K, typename C = CompareLeft,
+            typename = typename C::is_transparent>
+  left_iterator find_left(K const& left) const noexcept {
+    return left_iterator(this, find<LEFT>(left));
+  }
+
+  right_iterator find_right(right_t const& right) const noexcept {
+    return right_iterator(this, find<RIGHT>(right));
+  }
+
+  template <typename K, typename C = CompareRight,
+            typename = typename C::is_transparent>
+  right_iterator find_right(K const& right) const noexcept {
+    return right_iterator(this, find<RIGHT>(right));
+  }
+
+  right_t const& at_left(left_t const& key) const {
+    return at_key<LEFT>(key);
+  }
+
+  template <typename K, typename C = CompareLeft,
+            typename = typename C::is_transparent>
+  right_t const& at_left(K const& key) const {
+    return at_key<LEFT>(key);
+  }
+
+  left_t const& at_right(right_t const& key) const {
+    return at_key<RIGHT>(key);
+  }
+
+  template <typename K, typename C = CompareRight,
+            typename = typename C::is_transparent>
+  left_t const& at_right(K const& key) const {
+    return at_key<RIGHT>(key);
+  }
+
+  template <typename = std::enable_if<std::is_default_constructible_v<Right>>>
+  right_t const& at_left_or_default(left_t const& key) {
+    index_t ind = find<LEFT>(key);
+
+    if (ind == NIL) {
+      right_t default_right = right_t();
+      ind = find<RIGHT>(default_right);
+
+      if (ind == NIL)
+        return *insert(key, std::move(default_right)).flip();
+
+      erase_from<LEFT>(ind);
+      slots[ind].value.left_val = key;
+      insert_node<LEFT>(ind);
+    }
+    return slots[ind].value.right_val;
+  }
+
+  template <typename = std::enable_if<std::is_default_constructible_v<Left>>>
+  left_t const& at_right_or_default(right_t const& key) {
+    index_t ind = find<RIGHT>(key);
+
+    if (ind == NIL) {
+      left_t default_left = left_t();
+      ind = find<LEFT>(default_left);
+
+      if (ind == NIL)
+        return *insert(std::move(default_left), key);
+
+      erase_from<RIGHT>(ind);
+      slots[ind].value.right_val = key;
+      insert_node<RIGHT>(ind);
+    }
+    return slots[ind].value.left_val;
+  }
+
+  left_iterator lower_bound_left(const left_t& left) const noexcept {
+    return left_iterator(this, bound<LEFT>(left, false));
+  }
+
+  template <typename K, typename C = CompareLeft,
+            typename = typename C::is_transparent>
+  left_iterator lower_bound_left(const K& left) const noexcept {
+    return left_iterator(this, bound<LEFT>(left, false));
+  }
+
+  left_iterator upper_bound_left(const left_t& left) const noexcept {
+    return left_iterator(this, bound<LEFT>(left, true));
+  }
+
+  template <typename K, typename C = CompareLeft,
+            typename = typename C::is_transparent>
+  left_iterator upper_bound_left(const K& left) const noexcept {
+    return left_iterator(this, bound<LEFT>(left, true));
+  }
+
+  right_iterator lower_bound_right(const right_t& right) const noexcept {
+    return right_iterator(this, bound<RIGHT>(right, false));
+  }
+
+  template <typename K, typename C = CompareRight,
+            typename = typename C::is_transparent>
+  right_iterator lower_bound_right(const K& right) const noexcept {
+    return right_iterator(this, bound<RIGHT>(right, false));
+  }
+
+  right_iterator upper_bound_right(const right_t& right) const noexcept {
+    return right_iterator(this, bound<RIGHT>(right, true));
+  }
+
+  template <typename K, typename C = CompareRight,
+            typename = typename C::is_transparent>
+  right_iterator upper_bound_right(const K& right) const noexcept {
+    return right_iterator(this, bound<RIGHT>(right, true));
+  }
+
+  left_iterator begin_left() const noexcept {
+    return left_iterator(this, extreme<LEFT>(root[LEFT], 0));
+  }
+
+  left_iterator end_left() const noexcept {
+    return left_iterator(this, NIL);
+  }
+
+  right_iterator begin_right() const noexcept {
+    return right_iterator(this, extreme<RIGHT>(root[RIGHT], 0));
+  }
+
+  right_iterator end_right() const noexcept {
+    return right_iterator(this, NIL);
+  }
+
+  bool empty() const noexcept {
+    return size_ == 0;
+  }
+
+  std::size_t size() const noexcept {
+    return size_;
+  }
+
+  std::size_t capacity() const noexcept {
+    return capacity_;
+  }
+
+  std::size_t memory_usage() const noexcept {
+    return capacity_ * sizeof(slot) + live.capacity() / 8;
+  }
+
+  allocator_type get_allocator() const noexcept {
+    return alloc;
+  }
+
+  friend bool operator==(compact_bimap const& a,
+                         compact_bimap const& b) noexcept {
+    if (a.size_ != b.size_) {
+      return false;
+    }
+
+    left_iterator left_it_a = a.begin_left();
+    left_iterator left_it_b = b.begin_left();
+    left_iterator a_end = a.end_left();
+
+    while (left_it_a != a_end) {
+      if (!(a.template equal<RIGHT>(*left_it_a.flip(), *left_it_b.flip()) &&
+            a.template equal<LEFT>(*left_it_a, *left_it_b))) {
+        return false;
+      }
+      left_it_a++;
+      left_it_b++;
+    }
+
+    return true;
+  }
+
+  friend bool operator!=(compact_bimap const& a,
+                         compact_bimap const& b) noexcept {
+    return !(a == b);
+  }
+
+private:
+  struct node {
+    template <typename left_t_, typename right_t_>
+    node(left_t_&& left, right_t_&& right)
+        : left_val(std::forward<left_t_>(left)),
+          right_val(std::forward<right_t_>(right)) {}
+
+    Left left_val;
+    Right right_val;
+    index_t sons[2][2]{{NIL, NIL}, {NIL, NIL}};
+    index_t parent[2]{NIL, NIL};
+  };
+
+  union slot {
+    slot() noexcept {}
+    ~slot() {}
+
+    node value;
+    index_t next_free;
+  };
+
+  using slot_allocator_t =
+      typename std::allocator_traits<Allocator>::template rebind_alloc<slot>;
+  using traits = std::allocator_traits<slot_allocator_t>;
+  using bool_allocator_t =
+      typename std::allocator_traits<Allocator>::template rebind_alloc<bool>;
+
+  slot_allocator_t alloc;
+  CompareLeft cmp_left;
+  CompareRight cmp_right;
+  slot* slots{nullptr};
+  std::vector<bool, bool_allocator_t> live;
+  index_t used{0};
+  index_t capacity_{0};
+  index_t free_head{NIL};
+  index_t root[2]{NIL, NIL};
+  std::size_t size_{0};
+
+  static std::uint32_t prior(index_t ind) noexcept {
+    ind ^= ind >> 16;
+    ind *= 0x85ebca6bU;
+    ind ^= ind >> 13;
+    ind *= 0xc2b2ae35U;
+    ind ^= ind >> 16;
+    return ind;
+  }
+
+  template <std::size_t side>
+  auto const& key(index_t ind) const noexcept {
+    if constexpr (side == LEFT) {
+      return slots[ind].value.left_val;
+    } else {
+      return slots[ind].value.right_val;
+    }
+  }
+
+  template <std::size_t side, typename X, typename Y>
+  bool less(X const& x, Y const& y) const noexcept {
+    if constexpr (side == LEFT) {
+      return cmp_left(x, y);
+    } else {
+      return cmp_right(x, y);
+    }
+  }
+
+  template <std::size_t side, typename X, typename Y>
+  bool equal(X const& x, Y const& y) const noexcept {
+    return !less<side>(x, y) && !less<side>(y, x);
+  }
+
+  index_t& son(std::size_t side, index_t ind, std::size_t dir) noexcept {
+    return slots[ind].value.sons[side][dir];
+  }
+
+  index_t son(std::size_t side, index_t ind, std::size_t dir) const noexcept {
+    return slots[ind].value.sons[side][dir];
+  }
+
+  index_t& parent(std::size_t side, index_t ind) noexcept {
+    return slots[ind].value.parent[side];
+  }
+
+  index_t parent(std::size_t side, index_t ind) const noexcept {
+    return slots[ind].value.parent[side];
+  }
+
+  void set_parent(std::size_t side, index_t ind, index_t new_parent) noexcept {
+    if (ind != NIL) {
+      parent(side, ind) = new_parent;
+    }
+  }
+
+  // dir = 0 for minimum, 1 for maximum
+  template <std::size_t side>
+  index_t extreme(index_t ind, std::size_t dir) const noexcept {
+    if (ind == NIL) {
+      return NIL;
+    }
+    while (son(side, ind, dir) != NIL) {
+      ind = son(side, ind, dir);
+    }
+    return ind;
+  }
+
+  template <std::size_t side>
+  index_t step(index_t ind, std::size_t dir) const noexcept {
+    if (ind == NIL) {
+      return extreme<side>(root[side], 1 - dir);
+    }
+    if (son(side, ind, dir) != NIL) {
+      return extreme<side>(son(side, ind, dir), 1 - dir);
+    }
+
+    index_t up = parent(side, ind);
+    while (up != NIL && son(side, up, dir) == ind) {
+      ind = up;
+      up = parent(side, up);
+    }
+    return up;
+  }
+
+  template <std::size_t side>
+  index_t next(index_t ind) const noexcept {
+    return step<side>(ind, 1);
+  }
+
+  template <std::size_t side>
+  index_t prev(index_t ind) const noexcept {
+    return step<side>(ind, 0);
+  }
+
+  template <std::size_t side, typename T>
+  index_t find(T const& val) const noexcept {
+    index_t ind = root[side];
+
+    while (ind != NIL) {
+      if (less<side>(key<side>(ind), val)) {
+        ind = son(side, ind, 1);
+      } else if (less<side>(val, key<side>(ind))) {
+        ind = son(side, ind, 0);
+      } else {
+        return ind;
+      }
+    }
+    return NIL;
+  }
+
+  // first element which is not less (upper = false) or greater than val
+  template <std::size_t side, typename T>
+  index_t bound(T const& val, bool upper) const noexcept {
+    index_t res = NIL;
+    index_t ind = root[side];
+
+    while (ind != NIL) {
+      bool go_left = upper ? less<side>(val, key<side>(ind))
+                           : !less<side>(key<side>(ind), val);
+      if (go_left) {
+        res = ind;
+        ind = son(side, ind, 0);
+      } else {
+        ind = son(side, ind, 1);
+      }
+    }
+    return res;
+  }
+
+  template <std::size_t side>
+  index_t merge(index_t first, index_t second) noexcept {
+    if (first == NIL) {
+      return second;
+    }
+
+    if (second == NIL) {
+      return first;
+    }
+
+    if (prior(first) < prior(second)) {
+      index_t res = merge<side>(first, son(side, second, 0));
+      son(side, second, 0) = res;
+      set_parent(side, res, second);
+      return second;
+    } else {
+      index_t res = merge<side>(son(side, first, 1), second);
+      son(side, first, 1) = res;
+      set_parent(side, res, first);
+      return first;
+    }
+  }
+
+  // elements less than val go to the first tree
+  template <std::size_t side, typename T>
+  std::pair<index_t, index_t> split(index_t ind, T const& val) noexcept {
+    if (ind == NIL) {
+      return {NIL, NIL};
+    }
+
+    if (less<side>(key<side>(ind), val)) {
+      auto [first, second] = split<side>(son(side, ind, 1), val);
+      son(side, ind, 1) = first;
+      set_parent(side, first, ind);
+      set_parent(side, second, NIL);
+      return {ind, second};
+    } else {
+      auto [first, second] = split<side>(son(side, ind, 0), val);
+      son(side, ind, 0) = second;
+      set_parent(side, second, ind);
+      set_parent(side, first, NIL);
+      return {first, ind};
+    }
+  }
+
+  template <std::size_t side>
+  void insert_node(index_t ind) noexcept {
+    auto [first, second] = split<side>(root[side], key<side>(ind));
+    root[side] = merge<side>(merge<side>(first, ind), second);
+    parent(side, root[side]) = NIL;
+  }
+
+  template <std::size_t side>
+  void erase_from(index_t ind) noexcept {
+    index_t res = merge<side>(son(side, ind, 0), son(side, ind, 1));
+    index_t up = parent(side, ind);
+    set_parent(side, res, up);
+
+    if (up == NIL) {
+      root[side] = res;
+    } else if (son(side, up, 0) == ind) {
+      son(side, up, 0) = res;
+    } else {
+      son(side, up, 1) = res;
+    }
+
+    son(side, ind, 0) = son(side, ind, 1) = parent(side, ind) = NIL;
+  }
+
+  void erase_node(index_t ind) noexcept {
+    erase_from<LEFT>(ind);
+    erase_from<RIGHT>(ind);
+    destroy_node(ind);
+    size_--;
+  }
+
+  template <std::size_t side, typename K>
+  bool erase_key(K const& val) noexcept {
+    index_t ind = find<side>(val);
+    if (ind == NIL) {
+      return false;
+    }
+    erase_node(ind);
+    return true;
+  }
+
+  template <std::size_t side, typename K>
+  auto const& at_key(K const& val) const {
+    index_t ind = find<side>(val);
+
+    if (ind == NIL)
+      throw std::out_of_range("no such element");
+
+    return key<1 - side>(ind);
+  }
+
+  template <typename left_t_, typename right_t_>
+  index_t create_node(left_t_&& left, right_t_&& right) {
+    index_t ind = free_head;
+    index_t next_free = NIL;
+    if (ind == NIL) {
+      if (used == capacity_) {
+        reserve_exact(capacity_ == 0 ? 16 : std::size_t(capacity_) * 2);
+      }
+      ind = used;
+    } else {
+      next_free = slots[ind].next_free;
+    }
+
+    traits::construct(alloc, &slots[ind].value, std::forward<left_t_>(left),
+                      std::forward<right_t_>(right));
+
+    if (ind == used) {
+      used++;
+      live.push_back(true);
+    } else {
+      free_head = next_free;
+      live[ind] = true;
+    }
+    return ind;
+  }
+
+  void destroy_node(index_t ind) noexcept {
+    traits::destroy(alloc, &slots[ind].value);
+    slots[ind].next_free = free_head;
+    free_head = ind;
+    live[ind] = false;
+  }
+
+  void reserve_exact(std::size_t count) {
+    if (count >= NIL) {
+      count = NIL - 1;
+      if (count <= capacity_) {
+        throw std::length_error("compact_bimap is too large");
+      }
+    }
+
+    live.reserve(count);
+    slot* new_slots = traits::allocate(alloc, count);
+    // the old pairs are destroyed only once all of them are in the new
+    // array, so a copy which throws leaves the map as it was
+    index_t done = 0;
+    try {
+      for (; done < used; done++) {
+        if (live[done]) {
+          traits::construct(alloc, &new_slots[done].value,
+                            std::move_if_noexcept(slots[done].value));
+        } else {
+          new_slots[done].next_free = slots[done].next_free;
+        }
+      }
+    } catch (...) {
+      for (index_t i = 0; i < done; i++) {
+        if (live[i]) {
+          traits::destroy(alloc, &new_slots[i].value);
+        }
+      }
+      traits::deallocate(alloc, new_slots, count);
+      throw;
+    }
+
+    for (index_t i = 0; i < used; i++) {
+      if (live[i]) {
+        traits::destroy(alloc, &slots[i].value);
+      }
+    }
+    if (slots != nullptr) {
+      traits::deallocate(alloc, slots, capacity_);
+    }
+    slots = new_slots;
+    capacity_ = static_cast<index_t>(count);
+  }
+};
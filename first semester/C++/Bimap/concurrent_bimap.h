@@ -0,0 +1,217 @@
+#pragma once
+
+#include "bimap.h"
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+namespace tree_inside {
+
+inline std::size_t thread_slot() noexcept {
+  static std::atomic<std::size_t> threads{0};
+  thread_local std::size_t slot = threads.fetch_add(1);
+  return slot;
+}
+
+// counts readers inside a read section, the counters are spread over
+// cache lines so that readers on different cores don't share them
+struct read_indicator {
+  static constexpr std::size_t SLOTS = 64;
+
+  void arrive() noexcept {
+    counters[thread_slot() % SLOTS].value.fetch_add(1);
+  }
+
+  void depart() noexcept {
+    counters[thread_slot() % SLOTS].value.fetch_sub(1);
+  }
+
+  bool empty() const noexcept {
+    for (counter const& curr : counters) {
+      if (curr.value.load() != 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+private:
+  struct alignas(64) counter {
+    std::atomic<std::size_t> value{0};
+  };
+
+  counter counters[SLOTS];
+};
+} // namespace tree_inside
+
+// Left-Right: two copies of the bimap, readers use one of them and never
+// wait, the writer changes the other one, switches readers to it, waits
+// until the old one is left by everybody and repeats the change there.
+// Writers are serialized, every change is applied twice
+template <typename Left, typename Right, typename CompareLeft = std::less<Left>,
+          typename CompareRight = std::less<Right>,
+          typename Allocator = std::allocator<std::pair<Left, Right>>>
+struct concurrent_bimap {
+  using left_t = Left;
+  using right_t = Right;
+  using map_t = bimap<Left, Right, CompareLeft, CompareRight, Allocator>;
+
+  concurrent_bimap(CompareLeft compare_left = CompareLeft(),
+                   CompareRight compare_right = CompareRight(),
+                   Allocator const& alloc = Allocator())
+      : maps{map_t(compare_left, compare_right, alloc),
+             map_t(compare_left, compare_right, alloc)} {}
+
+  explicit concurrent_bimap(map_t const& initial) : maps{initial, initial} {}
+
+  concurrent_bimap(concurrent_bimap const&) = delete;
+  concurrent_bimap& operator=(concurrent_bimap const&) = delete;
+
+  // f gets map_t const& and must not keep references after it returns
+  template <typename F>
+  decltype(auto) read(F&& f) const {
+    std::size_t version = version_index.load();
+    indicators[version].arrive();
+
+    struct departure {
+      tree_inside::read_indicator& indicator;
+      ~departure() {
+        indicator.depart();
+      }
+    } guard{indicators[version]};
+
+    return std::forward<F>(f)(
+        static_cast<map_t const&>(maps[left_right.load()]));
+  }
+
+  // f gets map_t& and is called for both copies, so it must be deterministic
+  // (do the same thing both times, e.g. not move from what it captured) and
+  // exception-neutral: if it throws, the copy it was changing is overwritten
+  // by a copy of the other one and the exception goes on. A throw from the
+  // second call keeps the change, which readers already see
+  template <typename F>
+  decltype(auto) update(F&& f) {
+    std::lock_guard<std::mutex> lock(writer);
+
+    std::size_t curr = left_right.load(std::memory_order_relaxed);
+    if constexpr (std::is_void_v<decltype(f(maps[1 - curr]))>) {
+      apply(f, 1 - curr);
+      publish(1 - curr);
+      apply(f, curr);
+    } else {
+      auto res = apply(f, 1 - curr);
+      publish(1 - curr);
+      apply(f, curr);
+      return res;
+    }
+  }
+
+  template <typename K>
+  std::optional<right_t> find_left(K const& key) const {
+    return read([&key](map_t const& curr) -> std::optional<right_t> {
+      auto it = curr.find_left(key);
+      if (it == curr.end_left()) {
+        return std::nullopt;
+      }
+      return *it.flip();
+    });
+  }
+
+  template <typename K>
+  std::optional<left_t> find_right(K const& key) const {
+    return read([&key](map_t const& curr) -> std::optional<left_t> {
+      auto it = curr.find_right(key);
+      if (it == curr.end_right()) {
+        return std::nullopt;
+      }
+      return *it.flip();
+    });
+  }
+
+  template <typename K>
+  bool contains_left(K const& key) const {
+    return read([&key](map_t const& curr) {
+      return curr.find_left(key) != curr.end_left();
+    });
+  }
+
+  template <typename K>
+  bool contains_right(K const& key) const {
+    return read([&key](map_t const& curr) {
+      return curr.find_right(key) != curr.end_right();
+    });
+  }
+
+  std::size_t size() const {
+    return read([](map_t const& curr) { return curr.size(); });
+  }
+
+  bool empty() const {
+    return size() == 0;
+  }
+
+  bool insert(left_t const& left, right_t const& right) {
+    return update([&left, &right](map_t& curr) {
+      return curr.insert(left, right) != curr.end_left();
+    });
+  }
+
+  template <typename K>
+  bool erase_left(K const& key) {
+    return update([&key](map_t& curr) { return curr.erase_left(key); });
+  }
+
+  template <typename K>
+  bool erase_right(K const& key) {
+    return update([&key](map_t& curr) { return curr.erase_right(key); });
+  }
+
+  void clear() {
+    update([](map_t& curr) { curr.clear(); });
+  }
+
+private:
+  map_t maps[2];
+  mutable tree_inside::read_indicator indicators[2];
+  std::atomic<std::size_t> left_right{0};
+  std::atomic<std::size_t> version_index{0};
+  std::mutex writer;
+
+  // f on a copy which nobody reads, resynced from the other one if f throws
+  template <typename F>
+  decltype(auto) apply(F& f, std::size_t ind) {
+    try {
+      return f(maps[ind]);
+    } catch (...) {
+      resync(ind);
+      throw;
+    }
+  }
+
+  // if even copying the map throws, the copies can't be made equal again,
+  // so noexcept turns it into std::terminate
+  void resync(std::size_t stale) noexcept {
+    maps[stale] = maps[1 - stale];
+  }
+
+  // after it nobody reads the copy which was used before
+  void publish(std::size_t next) noexcept {
+    left_right.store(next);
+
+    std::size_t prev_version = version_index.load(std::memory_order_relaxed);
+    std::size_t next_version = 1 - prev_version;
+    wait_empty(indicators[next_version]);
+    version_index.store(next_version);
+    wait_empty(indicators[prev_version]);
+  }
+
+  static void wait_empty(tree_inside::read_indicator const& indicator) noexcept {
+    while (!indicator.empty()) {
+      std::this_thread::yield();
+    }
+  }
+};
@@ -0,0 +1,801 @@
+#pragma once
+
+#include "bimap.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace tree_inside {
+
+template <typename T, typename Compare>
+inline constexpr bool is_simd_searchable_v =
+    std::is_arithmetic_v<T> && (std::is_same_v<Compare, std::less<T>> ||
+                                std::is_same_v<Compare, std::less<>>);
+
+// sorted values of one side in the Eytzinger order (the heap order of a
+// complete binary tree): the top levels share a few cache lines, and the
+// descent has no branches, so the next levels can be prefetched.
+// A side only looks at the arrays, the frozen_bimap keeps them alive
+template <typename T, typename Compare,
+          bool = is_simd_searchable_v<T, Compare>>
+struct frozen_side : Compare {
+  // the layout id written to snapshots
+  static constexpr uint32_t LAYOUT = 0;
+
+  // keys and their ranks by the place in the layout, places by rank
+  struct arrays {
+    std::vector<T> keys;
+    std::vector<uint32_t> slot_rank;
+    std::vector<uint32_t> rank_slot;
+  };
+
+  static std::size_t slots_for(std::size_t n) noexcept {
+    return n == 0 ? 0 : n + 1;
+  }
+
+  static arrays build(std::vector<T>&& sorted) {
+    arrays res;
+    std::size_t n = sorted.size();
+    if (n == 0) {
+      return res;
+    }
+
+    res.slot_rank.resize(n + 1);
+    res.rank_slot.resize(n);
+    std::size_t next = 0;
+    place(res, n, 1, next);
+
+    // keys[0] is never looked at
+    res.keys.reserve(n + 1);
+    res.keys.push_back(sorted[0]);
+    for (std::size_t k = 1; k <= n; k++) {
+      res.keys.push_back(std::move(sorted[res.slot_rank[k]]));
+    }
+    return res;
+  }
+
+  explicit frozen_side(Compare const& cmp) : Compare(cmp) {}
+
+  void attach(T const* keys_, uint32_t const* slot_rank_,
+              uint32_t const* rank_slot_, std::size_t n_) noexcept {
+    keys = keys_;
+    slot_rank = slot_rank_;
+    rank_slot = rank_slot_;
+    n = n_;
+  }
+
+  std::size_t size() const noexcept {
+    return n;
+  }
+
+  T const& value(std::size_t rank) const noexcept {
+    return keys[rank_slot[rank]];
+  }
+
+  template <typename K>
+  std::size_t lower_bound(K const& x) const noexcept {
+    return descend([this, &x](T const& key) { return compare(key, x); });
+  }
+
+  template <typename K>
+  std::size_t upper_bound(K const& x) const noexcept {
+    return descend([this, &x](T const& key) { return !compare(x, key); });
+  }
+
+  template <typename X, typename Y>
+  bool compare(X const& x, Y const& y) const noexcept {
+    return static_cast<Compare const&>(*this)(x, y);
+  }
+
+private:
+  T const* keys{nullptr};
+  uint32_t const* slot_rank{nullptr};
+  uint32_t const* rank_slot{nullptr};
+  std::size_t n{0};
+
+  static void place(arrays& res, std::size_t n, std::size_t k,
+                    std::size_t& next) noexcept {
+    if (k > n) {
+      return;
+    }
+    place(res, n, 2 * k, next);
+    res.slot_rank[k] = static_cast<uint32_t>(next);
+    res.rank_slot[next++] = static_cast<uint32_t>(k);
+    place(res, n, 2 * k + 1, next);
+  }
+
+  // goes right while go_right(key), the answer is where it went left last
+  template <typename F>
+  std::size_t descend(F const& go_right) const noexcept {
+    std::size_t k = 1;
+    while (k <= n) {
+      if (16 * k <= n) {
+        prefetch(keys + 16 * k);
+      }
+      k = 2 * k + go_right(keys[k]);
+    }
+
+    while (k & 1) {
+      k >>= 1;
+    }
+    k >>= 1;
+    return k == 0 ? n : slot_rank[k];
+  }
+};
+
+// arithmetic values with the usual order: a static B-tree with a cache
+// line of keys in a node, the keys of a node are counted with no branches,
+// which the compiler turns into SIMD comparisons
+template <typename T, typename Compare>
+struct frozen_side<T, Compare, true> : Compare {
+  static constexpr std::size_t B = sizeof(T) < 64 ? 64 / sizeof(T) : 1;
+  static constexpr uint32_t LAYOUT = B;
+
+  struct arrays {
+    std::vector<T> keys;
+    std::vector<uint32_t> slot_rank;
+    std::vector<uint32_t> rank_slot;
+  };
+
+  static std::size_t slots_for(std::size_t n) noexcept {
+    return (n + B - 1) / B * B;
+  }
+
+  // the free places after the last key hold the greatest value and rank n:
+  // for floating point that is +inf, as max would sort before an inf key
+  static arrays build(std::vector<T>&& sorted) {
+    arrays res;
+    std::size_t n = sorted.size();
+    std::size_t slots = slots_for(n);
+    res.keys.assign(slots, std::numeric_limits<T>::has_infinity
+                               ? std::numeric_limits<T>::infinity()
+                               : std::numeric_limits<T>::max());
+    res.slot_rank.assign(slots, static_cast<uint32_t>(n));
+    res.rank_slot.resize(n);
+
+    std::size_t next = 0;
+    place(res, sorted, 0, next);
+    return res;
+  }
+
+  explicit frozen_side(Compare const& cmp) : Compare(cmp) {}
+
+  void attach(T const* keys_, uint32_t const* slot_rank_,
+              uint32_t const* rank_slot_, std::size_t n_) noexcept {
+    keys = keys_;
+    slot_rank = slot_rank_;
+    rank_slot = rank_slot_;
+    n = n_;
+    blocks_count = slots_for(n) / B;
+  }
+
+  std::size_t size() const noexcept {
+    return n;
+  }
+
+  T const& value(std::size_t rank) const noexcept {
+    return keys[rank_slot[rank]];
+  }
+
+  template <typename K>
+  std::size_t lower_bound(K const& x) const noexcept {
+    if constexpr (std::is_same_v<K, T>) {
+      return descend([&x](T key) { return key < x; });
+    } else {
+      return search([this, &x](T const& key) { return compare(key, x); });
+    }
+  }
+
+  template <typename K>
+  std::size_t upper_bound(K const& x) const noexcept {
+    if constexpr (std::is_same_v<K, T>) {
+      return descend([&x](T key) { return !(x < key); });
+    } else {
+      return search([this, &x](T const& key) { return !compare(x, key); });
+    }
+  }
+
+  template <typename X, typename Y>
+  bool compare(X const& x, Y const& y) const noexcept {
+    return static_cast<Compare const&>(*this)(x, y);
+  }
+
+private:
+  T const* keys{nullptr};
+  uint32_t const* slot_rank{nullptr};
+  uint32_t const* rank_slot{nullptr};
+  std::size_t n{0};
+  std::size_t blocks_count{0};
+
+  static std::size_t child(std::size_t k, std::size_t i) noexcept {
+    return k * (B + 1) + i + 1;
+  }
+
+  static void place(arrays& res, std::vector<T> const& sorted, std::size_t k,
+                    std::size_t& next) noexcept {
+    if (k * B >= res.keys.size()) {
+      return;
+    }
+    for (std::size_t i = 0; i <= B; i++) {
+      place(res, sorted, child(k, i), next);
+      if (i < B && next < sorted.size()) {
+        res.keys[k * B + i] = sorted[next];
+        res.slot_rank[k * B + i] = static_cast<uint32_t>(next);
+        res.rank_slot[next++] = static_cast<uint32_t>(k * B + i);
+      }
+    }
+  }
+
+  template <typename F>
+  std::size_t descend(F const& go_right) const noexcept {
+    std::size_t res = n;
+    std::size_t k = 0;
+
+    while (k < blocks_count) {
+      T const* block = keys + k * B;
+      std::size_t count = 0;
+      for (std::size_t i = 0; i < B; i++) {
+        count += go_right(block[i]);
+      }
+
+      if (count < B) {
+        res = slot_rank[k * B + count];
+      }
+      k = child(k, count);
+    }
+    return res;
+  }
+
+  // binary search by rank for keys of other types
+  template <typename F>
+  std::size_t search(F const& go_right) const noexcept {
+    std::size_t from = 0;
+    std::size_t to = n;
+    while (from < to) {
+      std::size_t mid = from + (to - from) / 2;
+      if (go_right(value(mid))) {
+        from = mid + 1;
+      } else {
+        to = mid;
+      }
+    }
+    return from;
+  }
+};
+} // namespace tree_inside
+
+// read-only copy of a bimap: the sides are sorted arrays in a search
+// friendly layout, flip() goes through the permutation between them
+template <typename Left, typename Right, typename CompareLeft = std::less<Left>,
+          typename CompareRight = std::less<Right>>
+struct frozen_bimap {
+  using left_t = Left;
+  using right_t = Right;
+
+  using left_tag = tree_inside::left_tag;
+  using right_tag = tree_inside::right_tag;
+
+  using left_side_t = tree_inside::frozen_side<Left, CompareLeft>;
+  using right_side_t = tree_inside::frozen_side<Right, CompareRight>;
+
+  template <typename value, typename Tag>
+  struct iterator {
+    iterator() = delete;
+
+    iterator(frozen_bimap const* owner_, std::size_t rank_) noexcept
+        : owner(owner_), rank(rank_) {}
+
+    value const* operator->() const noexcept {
+      return &**this;
+    }
+
+    value const& operator*() const noexcept {
+      return owner->template side<Tag>().value(rank);
+    }
+
+    iterator operator--(int) noexcept {
+      iterator res = *this;
+      --rank;
+      return res;
+    }
+
+    iterator& operator--() noexcept {
+      --rank;
+      return *this;
+    }
+
+    iterator operator++(int) noexcept {
+      iterator res = *this;
+      ++rank;
+      return res;
+    }
+
+    iterator& operator++() noexcept {
+      ++rank;
+      return *this;
+    }
+
+    iterator& operator+=(std::ptrdiff_t n) noexcept {
+      rank += n;
+      return *this;
+    }
+
+    iterator& operator-=(std::ptrdiff_t n) noexcept {
+      rank -= n;
+      return *this;
+    }
+
+    friend iterator operator+(iterator it, std::ptrdiff_t n) noexcept {
+      return it += n;
+    }
+
+    friend iterator operator-(iterator it, std::ptrdiff_t n) noexcept {
+      return it -= n;
+    }
+
+    friend std::ptrdiff_t operator-(iterator const& a,
+                                    iterator const& b) noexcept {
+      return static_cast<std::ptrdiff_t>(a.rank) -
+             static_cast<std::ptrdiff_t>(b.rank);
+    }
+
+    using tag =
+        std::conditional_t<std::is_same_v<Tag, left_tag>, right_tag, left_tag>;
+    using t =
+        std::conditional_t<std::is_same_v<Tag, left_tag>, right_t, left_t>;
+    using curr_it = iterator<t, tag>;
+
+    curr_it flip() const noexcept {
+      uint32_t const* cross = owner->template cross<Tag>();
+      return curr_it(owner, rank < owner->count ? cross[rank] : rank);
+    }
+
+    bool operator==(iterator const& other) const noexcept {
+      return rank == other.rank;
+    }
+
+    bool operator!=(iterator const& other) const noexcept {
+      return !(*this == other);
+    }
+
+    friend frozen_bimap;
+
+  private:
+    frozen_bimap const* owner;
+    std::size_t rank;
+  };
+
+  using left_iterator = iterator<left_t, left_tag>;
+  using right_iterator = iterator<right_t, right_tag>;
+
+  // O(n): both sides are already sorted in the bimap, the pairs are
+  // matched by the addresses of the right values with a radix sort; the
+  // comparators are those of source
+  template <typename Allocator, typename Stats>
+  explicit frozen_bimap(
+      bimap<Left, Right, CompareLeft, CompareRight, Allocator, Stats> const&
+          source)
+      : frozen_bimap(source, source.key_comp_left(), source.key_comp_right()) {
+  }
+
+  // the comparators must give the same orders as those of source
+  template <typename Allocator, typename Stats>
+  frozen_bimap(
+      bimap<Left, Right, CompareLeft, CompareRight, Allocator, Stats> const&
+          source,
+      CompareLeft compare_left, CompareRight compare_right)
+      : left_side(compare_left), right_side(compare_right) {
+    attach(std::make_shared<owned>(collect(source)));
+  }
+
+  // the snapshot keeps the search layout as it is, so map() can use the
+  // file without reading it; only trivially copyable types can be saved
+  void save(std::string const& path) const {
+    static_assert(std::is_trivially_copyable_v<Left> &&
+                      std::is_trivially_copyable_v<Right>,
+                  "only trivially copyable values can be saved");
+
+    std::size_t left_slots = left_side_t::slots_for(count);
+    std::size_t right_slots = right_side_t::slots_for(count);
+    snapshot_header header = make_header(count);
+    std::pair<void const*, std::size_t> parts[PARTS] = {
+        {left_keys, left_slots * sizeof(Left)},
+        {left_slot_rank, left_slots * sizeof(uint32_t)},
+        {left_rank_slot, count * sizeof(uint32_t)},
+        {right_keys, right_slots * sizeof(Right)},
+        {right_slot_rank, right_slots * sizeof(uint32_t)},
+        {right_rank_slot, count * sizeof(uint32_t)},
+        {left_to_right, count * sizeof(uint32_t)},
+        {right_to_left, count * sizeof(uint32_t)}};
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<char const*>(&header), sizeof(header));
+    std::size_t written = sizeof(header);
+    char const zeros[ALIGN] = {};
+    for (std::size_t i = 0; i < PARTS; i++) {
+      out.write(zeros, header.offsets[i] - written);
+      out.write(static_cast<char const*>(parts[i].first), parts[i].second);
+      written = header.offsets[i] + parts[i].second;
+    }
+    out.close();
+    if (!out) {
+      throw std::runtime_error("can't write " + path);
+    }
+  }
+
+  // the frozen_bimap reads straight from the mapped file, which is shared
+  // by all the processes mapping it; the file must come from save() of the
+  // same types and comparators, its contents are not checked
+  static frozen_bimap map(std::string const& path,
+                          CompareLeft compare_left = CompareLeft(),
+                          CompareRight compare_right = CompareRight()) {
+    static_assert(std::is_trivially_copyable_v<Left> &&
+                      std::is_trivially_copyable_v<Right>,
+                  "only trivially copyable values can be mapped");
+
+    frozen_bimap res(compare_left, compare_right);
+    std::size_t file_size = 0;
+    std::shared_ptr<void const> storage = map_file(path, file_size);
+    unsigned char const* base = static_cast<unsigned char const*>(storage.get());
+
+    snapshot_header header;
+    if (file_size < sizeof(header)) {
+      throw std::runtime_error(path + " is not a bimap snapshot");
+    }
+    std::memcpy(&header, base, sizeof(header));
+
+    snapshot_header expected = make_header(header.count);
+    if (std::memcmp(&header, &expected, sizeof(header)) != 0 ||
+        header.file_size != file_size) {
+      throw std::runtime_error(path + " is not a snapshot of this bimap type");
+    }
+
+    res.storage = storage;
+    res.count = header.count;
+    auto part = [base, &header](std::size_t i) {
+      return static_cast<void const*>(base + header.offsets[i]);
+    };
+    res.left_keys = static_cast<Left const*>(part(0));
+    res.left_slot_rank = static_cast<uint32_t const*>(part(1));
+    res.left_rank_slot = static_cast<uint32_t const*>(part(2));
+    res.right_keys = static_cast<Right const*>(part(3));
+    res.right_slot_rank = static_cast<uint32_t const*>(part(4));
+    res.right_rank_slot = static_cast<uint32_t const*>(part(5));
+    res.left_to_right = static_cast<uint32_t const*>(part(6));
+    res.right_to_left = static_cast<uint32_t const*>(part(7));
+    res.attach_sides();
+    return res;
+  }
+
+  left_iterator find_left(left_t const& left) const noexcept {
+    return left_iterator(this, find(left_side, left));
+  }
+
+  template <typename K, typename C = CompareLeft,
+            typename = typename C::is_transparent>
+  left_iterator find_left(K const& left) const noexcept {
+    return left_iterator(this, find(left_side, left));
+  }
+
+  right_iterator find_right(right_t const& right) const noexcept {
+    return right_iterator(this, find(right_side, right));
+  }
+
+  template <typename K, typename C = CompareRight,
+            typename = typename C::is_transparent>
+  right_iterator find_right(K const& right) const noexcept {
+    return right_iterator(this, find(right_side, right));
+  }
+
+  right_t const& at_left(left_t const& key) const {
+    left_iterator it = find_left(key);
+
+    if (it == end_left())
+      throw std::out_of_range("no such element");
+
+    return *it.flip();
+  }
+
+  left_t const& at_right(right_t const& key) const {
+    right_iterator it = find_right(key);
+
+    if (it == end_right())
+      throw std::out_of_range("no such element");
+
+    return *it.flip();
+  }
+
+  left_iterator lower_bound_left(left_t const& left) const noexcept {
+    return left_iterator(this, left_side.lower_bound(left));
+  }
+
+  template <typename K, typename C = CompareLeft,
+            typename = typename C::is_transparent>
+  left_iterator lower_bound_left(K const& left) const noexcept {
+    return left_iterator(this, left_side.lower_bound(left));
+  }
+
+  left_iterator upper_bound_left(left_t const& left) const noexcept {
+    return left_iterator(this, left_side.upper_bound(left));
+  }
+
+  template <typename K, typename C = CompareLeft,
+            typename = typename C::is_transparent>
+  left_iterator upper_bound_left(K const& left) const noexcept {
+    return left_iterator(this, left_side.upper_bound(left));
+  }
+
+  right_iterator lower_bound_right(right_t const& right) const noexcept {
+    return right_iterator(this, right_side.lower_bound(right));
+  }
+
+  template <typename K, typename C = CompareRight,
+            typename = typename C::is_transparent>
+  right_iterator lower_bound_right(K const& right) const noexcept {
+    return right_iterator(this, right_side.lower_bound(right));
+  }
+
+  right_iterator upper_bound_right(right_t const& right) const noexcept {
+    return right_iterator(this, right_side.upper_bound(right));
+  }
+
+  template <typename K, typename C = CompareRight,
+            typename = typename C::is_transparent>
+  right_iterator upper_bound_right(K const& right) const noexcept {
+    return right_iterator(this, right_side.upper_bound(right));
+  }
+
+  left_iterator begin_left() const noexcept {
+    return left_iterator(this, 0);
+  }
+
+  left_iterator end_left() const noexcept {
+    return left_iterator(this, size());
+  }
+
+  right_iterator begin_right() const noexcept {
+    return right_iterator(this, 0);
+  }
+
+  right_iterator end_right() const noexcept {
+    return right_iterator(this, size());
+  }
+
+  bool empty() const noexcept {
+    return size() == 0;
+  }
+
+  std::size_t size() const noexcept {
+    return count;
+  }
+
+private:
+  struct sorted_sides {
+    std::vector<Left> left;
+    std::vector<Right> right;
+    std::vector<uint32_t> left_to_right;
+  };
+
+  struct owned {
+    typename left_side_t::arrays left;
+    typename right_side_t::arrays right;
+    std::vector<uint32_t> left_to_right;
+    std::vector<uint32_t> right_to_left;
+
+    explicit owned(sorted_sides&& sides)
+        : left(left_side_t::build(std::move(sides.left))),
+          right(right_side_t::build(std::move(sides.right))),
+          left_to_right(std::move(sides.left_to_right)),
+          right_to_left(left_to_right.size()) {
+      for (std::size_t i = 0; i < left_to_right.size(); i++) {
+        right_to_left[left_to_right[i]] = static_cast<uint32_t>(i);
+      }
+    }
+  };
+
+  static constexpr std::size_t PARTS = 8;
+  static constexpr std::size_t ALIGN = 64;
+  // 2: floating point keys are padded with +inf
+  static constexpr uint32_t VERSION = 2;
+
+  struct snapshot_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t left_size;
+    uint32_t right_size;
+    uint32_t left_layout;
+    uint32_t right_layout;
+    uint64_t count;
+    uint64_t offsets[PARTS];
+    uint64_t file_size;
+  };
+
+  // the arrays belong to storage: vectors of owned or a mapped file
+  std::shared_ptr<void const> storage;
+  left_side_t left_side;
+  right_side_t right_side;
+  std::size_t count{0};
+  Left const* left_keys{nullptr};
+  uint32_t const* left_slot_rank{nullptr};
+  uint32_t const* left_rank_slot{nullptr};
+  Right const* right_keys{nullptr};
+  uint32_t const* right_slot_rank{nullptr};
+  uint32_t const* right_rank_slot{nullptr};
+  uint32_t const* left_to_right{nullptr};
+  uint32_t const* right_to_left{nullptr};
+
+  frozen_bimap(CompareLeft const& compare_left,
+               CompareRight const& compare_right)
+      : left_side(compare_left), right_side(compare_right) {}
+
+  void attach(std::shared_ptr<owned> data) noexcept {
+    count = data->left_to_right.size();
+    left_keys = data->left.keys.data();
+    left_slot_rank = data->left.slot_rank.data();
+    left_rank_slot = data->left.rank_slot.data();
+    right_keys = data->right.keys.data();
+    right_slot_rank = data->right.slot_rank.data();
+    right_rank_slot = data->right.rank_slot.data();
+    left_to_right = data->left_to_right.data();
+    right_to_left = data->right_to_left.data();
+    storage = std::move(data);
+    attach_sides();
+  }
+
+  void attach_sides() noexcept {
+    left_side.attach(left_keys, left_slot_rank, left_rank_slot, count);
+    right_side.attach(right_keys, right_slot_rank, right_rank_slot, count);
+  }
+
+  static snapshot_header make_header(std::size_t items) noexcept {
+    std::size_t left_slots = left_side_t::slots_for(items);
+    std::size_t right_slots = right_side_t::slots_for(items);
+    snapshot_header res;
+    std::memset(&res, 0, sizeof(res));
+    std::memcpy(res.magic, "BIMAPSNP", sizeof(res.magic));
+    res.version = VERSION;
+    res.byte_order = 0x01020304;
+    res.left_size = sizeof(Left);
+    res.right_size = sizeof(Right);
+    res.left_layout = left_side_t::LAYOUT;
+    res.right_layout = right_side_t::LAYOUT;
+    res.count = items;
+
+    std::size_t sizes[PARTS] = {
+        left_slots * sizeof(Left),  left_slots * sizeof(uint32_t),
+        items * sizeof(uint32_t),   right_slots * sizeof(Right),
+        right_slots * sizeof(uint32_t), items * sizeof(uint32_t),
+        items * sizeof(uint32_t),   items * sizeof(uint32_t)};
+    std::size_t offset = sizeof(res);
+    for (std::size_t i = 0; i < PARTS; i++) {
+      offset = (offset + ALIGN - 1) / ALIGN * ALIGN;
+      res.offsets[i] = offset;
+      offset += sizes[i];
+    }
+    res.file_size = offset;
+    return res;
+  }
+
+  static std::shared_ptr<void const> map_file(std::string const& path,
+                                              std::size_t& size) {
+#if defined(__unix__) || defined(__APPLE__)
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw std::runtime_error("can't open " + path);
+    }
+    struct stat info;
+    if (::fstat(fd, &info) != 0 || info.st_size == 0) {
+      ::close(fd);
+      throw std::runtime_error("can't map " + path);
+    }
+    size = static_cast<std::size_t>(info.st_size);
+    void* addr = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+      throw std::runtime_error("can't map " + path);
+    }
+    return std::shared_ptr<void const>(addr, [size](void const* ptr) {
+      ::munmap(const_cast<void*>(ptr), size);
+    });
+#else
+    // no mmap: the file is read into memory once
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in) {
+      throw std::runtime_error("can't open " + path);
+    }
+    size = static_cast<std::size_t>(in.tellg());
+    auto data = std::make_shared<std::vector<unsigned char>>(size);
+    in.seekg(0);
+    in.read(reinterpret_cast<char*>(data->data()), size);
+    if (!in) {
+      throw std::runtime_error("can't read " + path);
+    }
+    return std::shared_ptr<void const>(data, data->data());
+#endif
+  }
+
+  template <typename Tag>
+  auto const& side() const noexcept {
+    if constexpr (std::is_same_v<Tag, left_tag>) {
+      return left_side;
+    } else {
+      return right_side;
+    }
+  }
+
+  template <typename Tag>
+  uint32_t const* cross() const noexcept {
+    if constexpr (std::is_same_v<Tag, left_tag>) {
+      return left_to_right;
+    } else {
+      return right_to_left;
+    }
+  }
+
+  template <typename side_t, typename K>
+  static std::size_t find(side_t const& curr_side, K const& key) noexcept {
+    std::size_t rank = curr_side.lower_bound(key);
+    if (rank != curr_side.size() &&
+        curr_side.compare(key, curr_side.value(rank))) {
+      return curr_side.size();
+    }
+    return rank;
+  }
+
+  using match_t = std::pair<std::uintptr_t, uint32_t>;
+
+  template <typename Allocator, typename Stats>
+  static sorted_sides collect(
+      bimap<Left, Right, CompareLeft, CompareRight, Allocator, Stats> const&
+          source) {
+    if (source.size() > std::numeric_limits<uint32_t>::max()) {
+      throw std::length_error("frozen_bimap is too large");
+    }
+
+    sorted_sides res;
+    std::vector<match_t> by_left;
+    std::vector<match_t> by_right;
+    res.left.reserve(source.size());
+    res.right.reserve(source.size());
+    by_left.reserve(source.size());
+    by_right.reserve(source.size());
+
+    for (auto it = source.begin_left(); it != source.end_left(); ++it) {
+      auto const& right = *it.flip();
+      by_left.emplace_back(reinterpret_cast<std::uintptr_t>(&right),
+                           static_cast<uint32_t>(res.left.size()));
+      res.left.push_back(*it);
+    }
+    for (auto it = source.begin_right(); it != source.end_right(); ++it) {
+      by_right.emplace_back(reinterpret_cast<std::uintptr_t>(&*it),
+                            static_cast<uint32_t>(res.right.size()));
+      res.right.push_back(*it);
+    }
+
+    tree_inside::sort_by_address(by_left);
+    tree_inside::sort_by_address(by_right);
+    res.left_to_right.resize(source.size());
+    for (std::size_t i = 0; i < by_left.size(); i++) {
+      res.left_to_right[by_left[i].second] = by_right[i].second;
+    }
+    return res;
+  }
+};
@@ -0,0 +1,619 @@
+#pragma once
+
+#include "node_pool.h"
+#include "treap.h"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// unordered bimap: both sides are open addressing tables (linear probing
+// with backward shift deletion) over the same nodes, iterators go in the
+// order of slots and are invalidated by insert and erase
+template <typename Left, typename Right, typename HashLeft = std::hash<Left>,
+          typename HashRight = std::hash<Right>,
+          typename EqualLeft = std::equal_to<Left>,
+          typename EqualRight = std::equal_to<Right>,
+          typename Allocator = std::allocator<std::pair<Left, Right>>>
+struct hash_bimap {
+  using left_t = Left;
+  using right_t = Right;
+  using allocator_type = Allocator;
+
+  static constexpr std::size_t LEFT = 0;
+  static constexpr std::size_t RIGHT = 1;
+
+private:
+  struct node {
+    template <typename left_t_, typename right_t_>
+    node(left_t_&& left, right_t_&& right)
+        : left_val(std::forward<left_t_>(left)),
+          right_val(std::forward<right_t_>(right)) {}
+
+    Left left_val;
+    Right right_val;
+    std::size_t slot[2]{0, 0};
+  };
+
+  struct entry {
+    node* ptr{nullptr};
+    std::size_t hash{0};
+  };
+
+  using pool_t = tree_inside::node_pool<node, Allocator>;
+  using entry_allocator_t =
+      typename std::allocator_traits<Allocator>::template rebind_alloc<entry>;
+  using table_t = std::vector<entry, entry_allocator_t>;
+
+public:
+  template <typename value, std::size_t side>
+  struct iterator {
+    iterator() = delete;
+
+    iterator(hash_bimap const* owner_, std::size_t ind_) noexcept
+        : owner(owner_), ind(ind_) {}
+
+    value const* operator->() const noexcept {
+      return &**this;
+    }
+
+    value const& operator*() const noexcept {
+      return key<side>(owner->tables[side][ind].ptr);
+    }
+
+    iterator operator--(int) noexcept {
+      iterator res = *this;
+      --(*this);
+      return res;
+    }
+
+    iterator& operator--() noexcept {
+      do {
+        ind--;
+      } while (owner->tables[side][ind].ptr == nullptr);
+      return *this;
+    }
+
+    iterator operator++(int) noexcept {
+      iterator res = *this;
+      ++(*this);
+      return res;
+    }
+
+    iterator& operator++() noexcept {
+      ind = owner->template first_used<side>(ind + 1);
+      return *this;
+    }
+
+    using t = std::conditional_t<side == LEFT, right_t, left_t>;
+    using curr_it = iterator<t, 1 - side>;
+
+    curr_it flip() const noexcept {
+      if (ind == owner->capacity()) {
+        return curr_it(owner, ind);
+      }
+      return curr_it(owner, owner->tables[side][ind].ptr->slot[1 - side]);
+    }
+
+    bool operator==(iterator const& other) const noexcept {
+      return ind == other.ind;
+    }
+
+    bool operator!=(iterator const& other) const noexcept {
+      return !(*this == other);
+    }
+
+    friend hash_bimap;
+
+  private:
+    hash_bimap const* owner;
+    std::size_t ind;
+  };
+
+  using left_iterator = iterator<left_t, LEFT>;
+  using right_iterator = iterator<right_t, RIGHT>;
+
+  hash_bimap(HashLeft hash_left = HashLeft(),
+             HashRight hash_right = HashRight(),
+             EqualLeft equal_left = EqualLeft(),
+             EqualRight equal_right = EqualRight(),
+             Allocator const& alloc_ = Allocator()) noexcept
+      : alloc(alloc_), hash_l(std::move(hash_left)),
+        hash_r(std::move(hash_right)), equal_l(std::move(equal_left)),
+        equal_r(std::move(equal_right)), tables{table_t(alloc_),
+                                                table_t(alloc_)} {}
+
+  hash_bimap(hash_bimap const& other)
+      : hash_bimap(other.hash_l, other.hash_r, other.equal_l, other.equal_r,
+                   std::allocator_traits<Allocator>::
+                       select_on_container_copy_construction(other.alloc)) {
+    reserve(other.size_);
+    for (entry const& curr : other.tables[LEFT]) {
+      if (curr.ptr != nullptr) {
+        insert(curr.ptr->left_val, curr.ptr->right_val);
+      }
+    }
+  }
+
+  hash_bimap(hash_bimap&& other) noexcept
+      : hash_bimap(other.hash_l, other.hash_r, other.equal_l, other.equal_r,
+                   other.alloc) {
+    swap(other);
+  }
+
+  hash_bimap& operator=(hash_bimap const& other) {
+    if (this != &other) {
+      hash_bimap tmp(other);
+      swap(tmp);
+    }
+    return *this;
+  }
+
+  hash_bimap& operator=(hash_bimap&& other) noexcept {
+    if (this != &other) {
+      swap(other);
+      other.clear();
+    }
+    return *this;
+  }
+
+  ~hash_bimap() {
+    clear();
+  }
+
+  void swap(hash_bimap& other) noexcept {
+    std::swap(alloc, other.alloc);
+    std::swap(hash_l, other.hash_l);
+    std::swap(hash_r, other.hash_r);
+    std::swap(equal_l, other.equal_l);
+    std::swap(equal_r, other.equal_r);
+    std::swap(pool, other.pool);
+    tables[LEFT].swap(other.tables[LEFT]);
+    tables[RIGHT].swap(other.tables[RIGHT]);
+    std::swap(shift, other.shift);
+    std::swap(size_, other.size_);
+  }
+
+  // keeps the tables, gives the nodes back to the allocator
+  void clear() noexcept {
+    for (std::size_t side : {LEFT, RIGHT}) {
+      for (entry& curr : tables[side]) {
+        if (side == LEFT && curr.ptr != nullptr) {
+          curr.ptr->~node();
+        }
+        curr.ptr = nullptr;
+      }
+    }
+
+    if (pool != nullptr) {
+      pool->release();
+    }
+    size_ = 0;
+  }
+
+  void reserve(std::size_t count) {
+    std::size_t new_capacity = capacity() == 0 ? MIN_CAPACITY : capacity();
+    while (new_capacity / 4 * 3 < count) {
+      new_capacity *= 2;
+    }
+    if (new_capacity != capacity()) {
+      rehash(new_capacity);
+    }
+  }
+
+  template <typename left_t_ = left_t, typename right_t_ = right_t>
+  left_iterator insert(left_t_&& left, right_t_&& right) {
+    if constexpr (!is_lookup_key_v<HashLeft, EqualLeft, left_t, left_t_>) {
+      return insert(left_t(std::forward<left_t_>(left)),
+                    std::forward<right_t_>(right));
+    } else if constexpr (!is_lookup_key_v<HashRight, EqualRight, right_t,
+                                          right_t_>) {
+      return insert(std::forward<left_t_>(left),
+                    right_t(std::forward<right_t_>(right)));
+    } else {
+      std::size_t left_hash = hash_l(left);
+      std::size_t right_hash = hash_r(right);
+      std::size_t left_slot = 0;
+      std::size_t right_slot = 0;
+      // the keys are looked for before the tables grow, so a rejected pair
+      // never rehashes and invalidates the iterators; an empty map may still
+      // have tables (after clear or erase), and then the slots come from them
+      if (capacity() != 0) {
+        bool left_found = false;
+        bool right_found = false;
+        std::tie(left_slot, left_found) = probe<LEFT>(left, left_hash);
+        std::tie(right_slot, right_found) = probe<RIGHT>(right, right_hash);
+        if (left_found || right_found) {
+          return end_left();
+        }
+      }
+      if (capacity() / 4 * 3 < size_ + 1) {
+        reserve(size_ + 1);
+        left_slot = probe<LEFT>(left, left_hash).first;
+        right_slot = probe<RIGHT>(right, right_hash).first;
+      }
+
+      node* curr_node = create_node(std::forward<left_t_>(left),
+                                    std::forward<right_t_>(right));
+      place<LEFT>(left_slot, curr_node, left_hash);
+      place<RIGHT>(right_slot, curr_node, right_hash);
+      size_++;
+      return left_iterator(this, left_slot);
+    }
+  }
+
+  void erase_left(left_iterator it) noexcept {
+    erase_node(tables[LEFT][it.ind].ptr);
+  }
+
+  void erase_right(right_iterator it) noexcept {
+    erase_node(tables[RIGHT][it.ind].ptr);
+  }
+
+  bool erase_left(left_t const& left) noexcept {
+    return erase_key<LEFT>(left);
+  }
+
+  template <typename K, typename H = HashLeft, typename E = EqualLeft,
+            typename = typename H::is_transparent,
+            typename = typename E::is_transparent>
+  bool erase_left(K const& left) noexcept {
+    return erase_key<LEFT>(left);
+  }
+
+  bool erase_right(right_t const& right) noexcept {
+    return erase_key<RIGHT>(right);
+  }
+
+  template <typename K, typename H = HashRight, typename E = EqualRight,
+            typename = typename H::is_transparent,
+            typename = typename E::is_transparent>
+  bool erase_right(K const& right) noexcept {
+    return erase_key<RIGHT>(right);
+  }
+
+  left_iterator find_left(left_t const& left) const noexcept {
+    return left_iterator(this, find<LEFT>(left));
+  }
+
+  template <typename K, typename H = HashLeft, typename E = EqualLeft,
+            typename = typename H::is_transparent,
+            typename = typename E::is_transparent>
+  left_iterator find_left(K const& left) const noexcept {
+    return left_iterator(this, find<LEFT>(left));
+  }
+
+  right_iterator find_right(right_t const& right) const noexcept {
+    return right_iterator(this, find<RIGHT>(right));
+  }
+
+  template <typename K, typename H = HashRight, typename E = EqualRight,
+            typename = typename H::is_transparent,
+            typename = typename E::is_transparent>
+  right_iterator find_right(K const& right) const noexcept {
+    return right_iterator(this, find<RIGHT>(right));
+  }
+
+  right_t const& at_left(left_t const& key) const {
+    return at_key<LEFT>(key);
+  }
+
+  template <typename K, typename H = HashLeft, typename E = EqualLeft,
+            typename = typename H::is_transparent,
+            typename = typename E::is_transparent>
+  right_t const& at_left(K const& key) const {
+    return at_key<LEFT>(key);
+  }
+
+  left_t const& at_right(right_t const& key) const {
+    return at_key<RIGHT>(key);
+  }
+
+  template <typename K, typename H = HashRight, typename E = EqualRight,
+            typename = typename H::is_transparent,
+            typename = typename E::is_transparent>
+  left_t const& at_right(K const& key) const {
+    return at_key<RIGHT>(key);
+  }
+
+  template <typename = std::enable_if<std::is_default_constructible_v<Right>>>
+  right_t const& at_left_or_default(left_t const& key) {
+    std::size_t ind = find<LEFT>(key);
+    if (ind != capacity()) {
+      return tables[LEFT][ind].ptr->right_val;
+    }
+
+    right_t default_right = right_t();
+    ind = find<RIGHT>(default_right);
+    if (ind == capacity()) {
+      return *insert(key, std::move(default_right)).flip();
+    }
+
+    node* curr_node = tables[RIGHT][ind].ptr;
+    remove<LEFT>(curr_node->slot[LEFT]);
+    curr_node->left_val = key;
+    relink<LEFT>(curr_node);
+    return curr_node->right_val;
+  }
+
+  template <typename = std::enable_if<std::is_default_constructible_v<Left>>>
+  left_t const& at_right_or_default(right_t const& key) {
+    std::size_t ind = find<RIGHT>(key);
+    if (ind != capacity()) {
+      return tables[RIGHT][ind].ptr->left_val;
+    }
+
+    left_t default_left = left_t();
+    ind = find<LEFT>(default_left);
+    if (ind == capacity()) {
+      return *insert(std::move(default_left), key);
+    }
+
+    node* curr_node = tables[LEFT][ind].ptr;
+    remove<RIGHT>(curr_node->slot[RIGHT]);
+    curr_node->right_val = key;
+    relink<RIGHT>(curr_node);
+    return curr_node->left_val;
+  }
+
+  left_iterator begin_left() const noexcept {
+    return left_iterator(this, first_used<LEFT>(0));
+  }
+
+  left_iterator end_left() const noexcept {
+    return left_iterator(this, capacity());
+  }
+
+  right_iterator begin_right() const noexcept {
+    return right_iterator(this, first_used<RIGHT>(0));
+  }
+
+  right_iterator end_right() const noexcept {
+    return right_iterator(this, capacity());
+  }
+
+  bool empty() const noexcept {
+    return size_ == 0;
+  }
+
+  std::size_t size() const noexcept {
+    return size_;
+  }
+
+  std::size_t capacity() const noexcept {
+    return tables[LEFT].size();
+  }
+
+  std::size_t memory_usage() const noexcept {
+    return (pool == nullptr ? 0 : pool->memory_usage()) +
+           2 * capacity() * sizeof(entry);
+  }
+
+  allocator_type get_allocator() const noexcept {
+    return alloc;
+  }
+
+  friend bool operator==(hash_bimap const& a, hash_bimap const& b) noexcept {
+    if (a.size_ != b.size_) {
+      return false;
+    }
+
+    for (entry const& curr : a.tables[LEFT]) {
+      if (curr.ptr == nullptr) {
+        continue;
+      }
+      std::size_t ind = b.template find<LEFT>(curr.ptr->left_val);
+      if (ind == b.capacity() ||
+          !a.equal_r(b.tables[LEFT][ind].ptr->right_val,
+                     curr.ptr->right_val)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  friend bool operator!=(hash_bimap const& a, hash_bimap const& b) noexcept {
+    return !(a == b);
+  }
+
+private:
+  static constexpr std::size_t MIN_CAPACITY = 16;
+
+  Allocator alloc;
+  HashLeft hash_l;
+  HashRight hash_r;
+  EqualLeft equal_l;
+  EqualRight equal_r;
+  std::shared_ptr<pool_t> pool;
+  table_t tables[2];
+  unsigned shift{64};
+  std::size_t size_{0};
+
+  template <typename Hash, typename Equal, typename T, typename K>
+  static constexpr bool is_lookup_key_v =
+      std::is_same_v<std::decay_t<K>, T> ||
+      (tree_inside::is_transparent<Hash>::value &&
+       tree_inside::is_transparent<Equal>::value);
+
+  template <std::size_t side>
+  static auto const& key(node const* curr_node) noexcept {
+    if constexpr (side == LEFT) {
+      return curr_node->left_val;
+    } else {
+      return curr_node->right_val;
+    }
+  }
+
+  template <std::size_t side, typename K>
+  std::size_t hash(K const& val) const noexcept {
+    if constexpr (side == LEFT) {
+      return hash_l(val);
+    } else {
+      return hash_r(val);
+    }
+  }
+
+  template <std::size_t side, typename K>
+  bool equal(node const* curr_node, K const& val) const noexcept {
+    if constexpr (side == LEFT) {
+      return equal_l(curr_node->left_val, val);
+    } else {
+      return equal_r(curr_node->right_val, val);
+    }
+  }
+
+  // fibonacci hashing, so that weak hashes like std::hash<int> spread well
+  std::size_t home(std::size_t hash_value) const noexcept {
+    return static_cast<std::size_t>(
+        (static_cast<std::uint64_t>(hash_value) * 0x9E3779B97F4A7C15ULL) >>
+        shift);
+  }
+
+  std::size_t mask() const noexcept {
+    return capacity() - 1;
+  }
+
+  template <std::size_t side>
+  std::size_t first_used(std::size_t ind) const noexcept {
+    while (ind < capacity() && tables[side][ind].ptr == nullptr) {
+      ind++;
+    }
+    return ind;
+  }
+
+  // the slot with val or the empty slot where it should go
+  template <std::size_t side, typename K>
+  std::pair<std::size_t, bool> probe(K const& val,
+                                     std::size_t hash_value) const noexcept {
+    table_t const& table = tables[side];
+    for (std::size_t ind = home(hash_value);; ind = (ind + 1) & mask()) {
+      entry const& curr = table[ind];
+      if (curr.ptr == nullptr) {
+        return {ind, false};
+      }
+      if (curr.hash == hash_value && equal<side>(curr.ptr, val)) {
+        return {ind, true};
+      }
+    }
+  }
+
+  template <std::size_t side, typename K>
+  std::size_t find(K const& val) const noexcept {
+    if (size_ == 0) {
+      return capacity();
+    }
+    auto [ind, found] = probe<side>(val, hash<side>(val));
+    return found ? ind : capacity();
+  }
+
+  template <std::size_t side, typename K>
+  bool erase_key(K const& val) noexcept {
+    std::size_t ind = find<side>(val);
+    if (ind == capacity()) {
+      return false;
+    }
+    erase_node(tables[side][ind].ptr);
+    return true;
+  }
+
+  template <std::size_t side, typename K>
+  auto const& at_key(K const& val) const {
+    std::size_t ind = find<side>(val);
+
+    if (ind == capacity())
+      throw std::out_of_range("no such element");
+
+    return key<1 - side>(tables[side][ind].ptr);
+  }
+
+  template <std::size_t side>
+  void place(std::size_t ind, node* curr_node,
+             std::size_t hash_value) noexcept {
+    tables[side][ind] = {curr_node, hash_value};
+    curr_node->slot[side] = ind;
+  }
+
+  template <std::size_t side>
+  void relink(node* curr_node) noexcept {
+    std::size_t hash_value = hash<side>(key<side>(curr_node));
+    place<side>(probe<side>(key<side>(curr_node), hash_value).first,
+                curr_node, hash_value);
+  }
+
+  // backward shift: later entries of the cluster move to the hole
+  // unless their home position lies between the hole and them
+  template <std::size_t side>
+  void remove(std::size_t hole) noexcept {
+    table_t& table = tables[side];
+    for (std::size_t ind = (hole + 1) & mask(); table[ind].ptr != nullptr;
+         ind = (ind + 1) & mask()) {
+      std::size_t ideal = home(table[ind].hash);
+      if (((ind - ideal) & mask()) >= ((ind - hole) & mask())) {
+        table[hole] = table[ind];
+        table[hole].ptr->slot[side] = hole;
+        hole = ind;
+      }
+    }
+    table[hole].ptr = nullptr;
+  }
+
+  void erase_node(node* curr_node) noexcept {
+    remove<LEFT>(curr_node->slot[LEFT]);
+    remove<RIGHT>(curr_node->slot[RIGHT]);
+    curr_node->~node();
+    pool->deallocate(curr_node);
+    size_--;
+  }
+
+  template <typename left_t_, typename right_t_>
+  node* create_node(left_t_&& left, right_t_&& right) {
+    if (pool == nullptr) {
+      pool = std::allocate_shared<pool_t>(alloc, alloc);
+    }
+
+    void* place = pool->allocate();
+    try {
+      return new (place)
+          node(std::forward<left_t_>(left), std::forward<right_t_>(right));
+    } catch (...) {
+      pool->deallocate(place);
+      throw;
+    }
+  }
+
+  void rehash(std::size_t new_capacity) {
+    table_t old[2] = {table_t(new_capacity, alloc),
+                      table_t(new_capacity, alloc)};
+    tables[LEFT].swap(old[LEFT]);
+    tables[RIGHT].swap(old[RIGHT]);
+
+    shift = 64;
+    for (std::size_t i = new_capacity; i > 1; i /= 2) {
+      shift--;
+    }
+
+    move_entries<LEFT>(old[LEFT]);
+    move_entries<RIGHT>(old[RIGHT]);
+  }
+
+  // the keys are known to be unique, so only empty slots are looked for
+  template <std::size_t side>
+  void move_entries(table_t const& old) noexcept {
+    for (entry const& curr : old) {
+      if (curr.ptr == nullptr) {
+        continue;
+      }
+
+      std::size_t ind = home(curr.hash);
+      while (tables[side][ind].ptr != nullptr) {
+        ind = (ind + 1) & mask();
+      }
+      place<side>(ind, curr.ptr, curr.hash);
+    }
+  }
+};
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+
+namespace tree_inside {
+
+template <typename Node, typename Allocator>
+struct node_pool {
+  node_pool() noexcept = default;
+
+  explicit node_pool(Allocator const& alloc_) noexcept : alloc(alloc_) {}
+
+  node_pool(node_pool const&) = delete;
+  node_pool& operator=(node_pool const&) = delete;
+
+  ~node_pool() {
+    release();
+  }
+
+  void* allocate() {
+    if (free_list != nullptr) {
+      cell* res = free_list;
+      free_list = res->next;
+      return res;
+    }
+
+    if (slab_used == slab_size) {
+      grow();
+    }
+    return &slabs[slab_used++];
+  }
+
+  void deallocate(void* ptr) noexcept {
+    cell* curr_cell = static_cast<cell*>(ptr);
+    curr_cell->next = free_list;
+    free_list = curr_cell;
+  }
+
+  // all nodes must be already destroyed
+  void release() noexcept {
+    while (slabs != nullptr) {
+      cell* next_slab = slabs->header.next_slab;
+      traits::deallocate(alloc, slabs, slabs->header.cells);
+      slabs = next_slab;
+    }
+
+    free_list = nullptr;
+    slab_used = slab_size = 0;
+    next_slab_size = MIN_SLAB_SIZE;
+    capacity_ = 0;
+  }
+
+  std::size_t capacity() const noexcept {
+    return capacity_;
+  }
+
+  std::size_t memory_usage() const noexcept {
+    return capacity_ * sizeof(cell);
+  }
+
+private:
+  union cell {
+    cell* next;
+    struct {
+      cell* next_slab;
+      std::size_t cells;
+    } header;
+    alignas(Node) unsigned char storage[sizeof(Node)];
+  };
+
+  using cell_allocator_t =
+      typename std::allocator_traits<Allocator>::template rebind_alloc<cell>;
+  using traits = std::allocator_traits<cell_allocator_t>;
+
+  static constexpr std::size_t MIN_SLAB_SIZE = 32;
+  static constexpr std::size_t MAX_SLAB_SIZE = 4096;
+
+  cell_allocator_t alloc;
+  cell* slabs{nullptr};
+  cell* free_list{nullptr};
+  std::size_t slab_used{0};
+  std::size_t slab_size{0};
+  std::size_t next_slab_size{MIN_SLAB_SIZE};
+  std::size_t capacity_{0};
+
+  // the first cell of every slab keeps the list of slabs
+  void grow() {
+    std::size_t cells = next_slab_size + 1;
+    cell* slab = traits::allocate(alloc, cells);
+
+    slab->header.next_slab = slabs;
+    slab->header.cells = cells;
+    slabs = slab;
+
+    slab_used = 1;
+    slab_size = cells;
+    capacity_ += cells - 1;
+    if (next_slab_size < MAX_SLAB_SIZE) {
+      next_slab_size *= 2;
+    }
+  }
+};
+} // namespace tree_inside
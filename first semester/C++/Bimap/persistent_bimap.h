@@ -0,0 +1,610 @@
+#pragma once
+
+#include "treap.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+namespace tree_inside {
+
+// a pair shared by the nodes of both sides in all versions
+template <typename Left, typename Right>
+struct persistent_entry {
+  template <typename Left_, typename Right_>
+  persistent_entry(Left_&& left_, Right_&& right_)
+      : left(std::forward<Left_>(left_)), right(std::forward<Right_>(right_)) {}
+
+  std::atomic<std::size_t> refs{0};
+  Left left;
+  Right right;
+};
+
+template <typename Entry>
+struct persistent_node {
+  std::atomic<std::size_t> refs{1};
+  uint32_t prior{0};
+  std::size_t size{1};
+  persistent_node* left{nullptr};
+  persistent_node* right{nullptr};
+  Entry* entry{nullptr};
+};
+
+// one side of persistent_bimap: a treap whose nodes are shared by versions
+// and counted by references; a node is changed in place only if one version
+// has it, otherwise the path to it is copied. The nodes an update may need
+// are allocated before anything changes
+template <typename T, std::size_t Side, typename Entry, typename Compare,
+          typename Allocator>
+struct persistent_treap : Compare {
+  using node = persistent_node<Entry>;
+
+  persistent_treap(Compare const& cmp, Allocator const& alloc)
+      : Compare(cmp), node_alloc(alloc), entry_alloc(alloc) {}
+
+  persistent_treap(persistent_treap const& other) noexcept
+      : Compare(other), node_alloc(other.node_alloc),
+        entry_alloc(other.entry_alloc), root(retain(other.root)) {}
+
+  persistent_treap& operator=(persistent_treap const&) = delete;
+
+  ~persistent_treap() {
+    release(root);
+    drop_spares();
+  }
+
+  void swap(persistent_treap& other) noexcept {
+    std::swap(static_cast<Compare&>(*this), static_cast<Compare&>(other));
+    std::swap(node_alloc, other.node_alloc);
+    std::swap(entry_alloc, other.entry_alloc);
+    std::swap(root, other.root);
+    std::swap(spare, other.spare);
+  }
+
+  void clear() noexcept {
+    release(root);
+    root = nullptr;
+  }
+
+  std::size_t size() const noexcept {
+    return size_of(root);
+  }
+
+  template <typename K>
+  Entry const* find(K const& x) const noexcept {
+    node const* curr = root;
+    while (curr != nullptr) {
+      if (compare(key(curr), x)) {
+        curr = curr->right;
+      } else if (compare(x, key(curr))) {
+        curr = curr->left;
+      } else {
+        return curr->entry;
+      }
+    }
+    return nullptr;
+  }
+
+  // f gets the entries in order
+  template <typename F>
+  void for_each(F& f) const {
+    for_each(root, f);
+  }
+
+  // the nodes copied by an insertion are on the search path of x below the
+  // first shared one, one more is for the new entry
+  template <typename K>
+  void reserve_insert(K const& x) {
+    std::size_t count = 1;
+    bool shared = false;
+    for (node const* curr = root; curr != nullptr;
+         curr = compare(key(curr), x) ? curr->right : curr->left) {
+      shared = shared || curr->refs.load(std::memory_order_acquire) > 1;
+      count += shared;
+    }
+    reserve(count);
+  }
+
+  // the same for the path to x and the two spines merged after it
+  template <typename K>
+  void reserve_erase(K const& x) {
+    std::size_t count = 0;
+    bool shared = false;
+    node const* curr = root;
+    while (compare(key(curr), x) || compare(x, key(curr))) {
+      shared = shared || curr->refs.load(std::memory_order_acquire) > 1;
+      count += shared;
+      curr = compare(key(curr), x) ? curr->right : curr->left;
+    }
+    shared = shared || curr->refs.load(std::memory_order_acquire) > 1;
+    count += spine(curr->left, shared, false) + spine(curr->right, shared, true);
+    reserve(count);
+  }
+
+  void drop_spares() noexcept {
+    while (spare != nullptr) {
+      node* next = spare->left;
+      free_node(spare);
+      spare = next;
+    }
+  }
+
+  // the key of entry must not be here
+  void insert(Entry* entry) noexcept {
+    node* new_node = take_spare();
+    new_node->prior = rnd();
+    new_node->entry = entry;
+    entry->refs.fetch_add(1, std::memory_order_relaxed);
+    root = insert(root, new_node);
+    drop_spares();
+  }
+
+  // x must be here
+  template <typename K>
+  void erase(K const& x) noexcept {
+    root = erase(root, x);
+    drop_spares();
+  }
+
+  template <typename X, typename Y>
+  bool compare(X const& x, Y const& y) const noexcept {
+    return static_cast<Compare const&>(*this)(x, y);
+  }
+
+private:
+  using node_allocator_t =
+      typename std::allocator_traits<Allocator>::template rebind_alloc<node>;
+  using entry_allocator_t =
+      typename std::allocator_traits<Allocator>::template rebind_alloc<Entry>;
+  using node_traits = std::allocator_traits<node_allocator_t>;
+  using entry_traits = std::allocator_traits<entry_allocator_t>;
+
+  node_allocator_t node_alloc;
+  entry_allocator_t entry_alloc;
+  node* root{nullptr};
+  // linked through left
+  node* spare{nullptr};
+
+  static T const& key(node const* curr) noexcept {
+    if constexpr (Side == 0) {
+      return curr->entry->left;
+    } else {
+      return curr->entry->right;
+    }
+  }
+
+  static std::size_t size_of(node const* curr) noexcept {
+    return curr == nullptr ? 0 : curr->size;
+  }
+
+  static void update_size(node* curr) noexcept {
+    curr->size = 1 + size_of(curr->left) + size_of(curr->right);
+  }
+
+  static node* retain(node* curr) noexcept {
+    if (curr != nullptr) {
+      curr->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    return curr;
+  }
+
+  void release(node* curr) noexcept {
+    if (curr == nullptr ||
+        curr->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+      return;
+    }
+    release(curr->left);
+    release(curr->right);
+    if (curr->entry->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      entry_traits::destroy(entry_alloc, curr->entry);
+      entry_traits::deallocate(entry_alloc, curr->entry, 1);
+    }
+    free_node(curr);
+  }
+
+  void free_node(node* curr) noexcept {
+    node_traits::destroy(node_alloc, curr);
+    node_traits::deallocate(node_alloc, curr, 1);
+  }
+
+  static std::size_t spine(node const* curr, bool shared,
+                           bool to_left) noexcept {
+    std::size_t count = 0;
+    for (; curr != nullptr; curr = to_left ? curr->left : curr->right) {
+      shared = shared || curr->refs.load(std::memory_order_acquire) > 1;
+      count += shared;
+    }
+    return count;
+  }
+
+  void reserve(std::size_t count) {
+    for (; count > 0; count--) {
+      node* curr = node_traits::allocate(node_alloc, 1);
+      node_traits::construct(node_alloc, curr);
+      curr->left = spare;
+      spare = curr;
+    }
+  }
+
+  node* take_spare() noexcept {
+    node* res = spare;
+    spare = res->left;
+    res->left = nullptr;
+    return res;
+  }
+
+  // curr belongs only to the version being changed after it
+  node* unique(node* curr) noexcept {
+    if (curr->refs.load(std::memory_order_acquire) == 1) {
+      return curr;
+    }
+
+    node* copy = take_spare();
+    copy->prior = curr->prior;
+    copy->size = curr->size;
+    copy->left = retain(curr->left);
+    copy->right = retain(curr->right);
+    copy->entry = curr->entry;
+    copy->entry->refs.fetch_add(1, std::memory_order_relaxed);
+    release(curr);
+    return copy;
+  }
+
+  // all these take the references they get and return new ones
+
+  node* insert(node* curr, node* new_node) noexcept {
+    if (curr == nullptr) {
+      return new_node;
+    }
+    if (new_node->prior > curr->prior) {
+      auto [less, greater] = split(curr, key(new_node));
+      new_node->left = less;
+      new_node->right = greater;
+      update_size(new_node);
+      return new_node;
+    }
+
+    curr = unique(curr);
+    if (compare(key(curr), key(new_node))) {
+      curr->right = insert(curr->right, new_node);
+    } else {
+      curr->left = insert(curr->left, new_node);
+    }
+    update_size(curr);
+    return curr;
+  }
+
+  // the elements less than x and the rest
+  std::pair<node*, node*> split(node* curr, T const& x) noexcept {
+    if (curr == nullptr) {
+      return {nullptr, nullptr};
+    }
+
+    curr = unique(curr);
+    if (compare(key(curr), x)) {
+      auto [less, greater] = split(curr->right, x);
+      curr->right = less;
+      update_size(curr);
+      return {curr, greater};
+    } else {
+      auto [less, greater] = split(curr->left, x);
+      curr->left = greater;
+      update_size(curr);
+      return {less, curr};
+    }
+  }
+
+  node* merge(node* first, node* second) noexcept {
+    if (first == nullptr) {
+      return second;
+    }
+    if (second == nullptr) {
+      return first;
+    }
+
+    if (first->prior > second->prior) {
+      first = unique(first);
+      first->right = merge(first->right, second);
+      update_size(first);
+      return first;
+    } else {
+      second = unique(second);
+      second->left = merge(first, second->left);
+      update_size(second);
+      return second;
+    }
+  }
+
+  // the entry of x may be freed here, x is not used after that
+  template <typename K>
+  node* erase(node* curr, K const& x) noexcept {
+    if (compare(key(curr), x)) {
+      curr = unique(curr);
+      curr->right = erase(curr->right, x);
+    } else if (compare(x, key(curr))) {
+      curr = unique(curr);
+      curr->left = erase(curr->left, x);
+    } else {
+      node* left = retain(curr->left);
+      node* right = retain(curr->right);
+      release(curr);
+      return merge(left, right);
+    }
+    update_size(curr);
+    return curr;
+  }
+
+  template <typename F>
+  static void for_each(node const* curr, F& f) {
+    if (curr == nullptr) {
+      return;
+    }
+    for_each(curr->left, f);
+    f(static_cast<Entry const&>(*curr->entry));
+    for_each(curr->right, f);
+  }
+};
+} // namespace tree_inside
+
+// a bimap whose copies share all nodes: copying (snapshot()) is O(1), an
+// update copies only the O(log n) nodes on its paths that some other
+// version still has. Different versions can be used from different threads
+// at once, one version must not be changed while it's being read
+template <typename Left, typename Right, typename CompareLeft = std::less<Left>,
+          typename CompareRight = std::less<Right>,
+          typename Allocator = std::allocator<std::pair<Left, Right>>>
+struct persistent_bimap {
+  using left_t = Left;
+  using right_t = Right;
+  using allocator_type = Allocator;
+
+private:
+  using entry_t = tree_inside::persistent_entry<Left, Right>;
+  using left_treap_t =
+      tree_inside::persistent_treap<Left, 0, entry_t, CompareLeft, Allocator>;
+  using right_treap_t =
+      tree_inside::persistent_treap<Right, 1, entry_t, CompareRight, Allocator>;
+  using entry_allocator_t =
+      typename std::allocator_traits<Allocator>::template rebind_alloc<entry_t>;
+  using entry_traits = std::allocator_traits<entry_allocator_t>;
+
+public:
+  persistent_bimap(CompareLeft compare_left = CompareLeft(),
+                   CompareRight compare_right = CompareRight(),
+                   Allocator const& alloc_ = Allocator())
+      : alloc(alloc_), left_treap(compare_left, alloc_),
+        right_treap(compare_right, alloc_) {}
+
+  persistent_bimap(persistent_bimap const& other) noexcept = default;
+
+  persistent_bimap(persistent_bimap&& other) noexcept
+      : persistent_bimap(other) {
+    other.clear();
+  }
+
+  persistent_bimap& operator=(persistent_bimap const& other) noexcept {
+    if (this != &other) {
+      persistent_bimap tmp(other);
+      swap(tmp);
+    }
+    return *this;
+  }
+
+  persistent_bimap& operator=(persistent_bimap&& other) noexcept {
+    if (this != &other) {
+      swap(other);
+      other.clear();
+    }
+    return *this;
+  }
+
+  ~persistent_bimap() = default;
+
+  void swap(persistent_bimap& other) noexcept {
+    std::swap(alloc, other.alloc);
+    left_treap.swap(other.left_treap);
+    right_treap.swap(other.right_treap);
+  }
+
+  // the current version, it doesn't change when this one does
+  persistent_bimap snapshot() const noexcept {
+    return *this;
+  }
+
+  void clear() noexcept {
+    left_treap.clear();
+    right_treap.clear();
+  }
+
+  template <typename left_t_ = left_t, typename right_t_ = right_t>
+  bool insert(left_t_&& left, right_t_&& right) {
+    if constexpr (!is_lookup_key_v<CompareLeft, left_t, left_t_>) {
+      return insert(left_t(std::forward<left_t_>(left)),
+                    std::forward<right_t_>(right));
+    } else if constexpr (!is_lookup_key_v<CompareRight, right_t, right_t_>) {
+      return insert(std::forward<left_t_>(left),
+                    right_t(std::forward<right_t_>(right)));
+    } else {
+      if (left_treap.find(left) != nullptr ||
+          right_treap.find(right) != nullptr) {
+        return false;
+      }
+
+      try {
+        left_treap.reserve_insert(left);
+        right_treap.reserve_insert(right);
+      } catch (...) {
+        left_treap.drop_spares();
+        right_treap.drop_spares();
+        throw;
+      }
+      entry_t* entry = create_entry(std::forward<left_t_>(left),
+                                    std::forward<right_t_>(right));
+      left_treap.insert(entry);
+      right_treap.insert(entry);
+      return true;
+    }
+  }
+
+  bool erase_left(left_t const& left) {
+    return erase_entry(left_treap.find(left));
+  }
+
+  template <typename K, typename C = CompareLeft,
+            typename = typename C::is_transparent>
+  bool erase_left(K const& left) {
+    return erase_entry(left_treap.find(left));
+  }
+
+  bool erase_right(right_t const& right) {
+    return erase_entry(right_treap.find(right));
+  }
+
+  template <typename K, typename C = CompareRight,
+            typename = typename C::is_transparent>
+  bool erase_right(K const& right) {
+    return erase_entry(right_treap.find(right));
+  }
+
+  // nullptr if there is no such left, the pointer is valid while some
+  // version has the pair
+  right_t const* find_left(left_t const& left) const noexcept {
+    return find_key<true>(left);
+  }
+
+  template <typename K, typename C = CompareLeft,
+            typename = typename C::is_transparent>
+  right_t const* find_left(K const& left) const noexcept {
+    return find_key<true>(left);
+  }
+
+  left_t const* find_right(right_t const& right) const noexcept {
+    return find_key<false>(right);
+  }
+
+  template <typename K, typename C = CompareRight,
+            typename = typename C::is_transparent>
+  left_t const* find_right(K const& right) const noexcept {
+    return find_key<false>(right);
+  }
+
+  right_t const& at_left(left_t const& key) const {
+    return at_key<true>(key);
+  }
+
+  template <typename K, typename C = CompareLeft,
+            typename = typename C::is_transparent>
+  right_t const& at_left(K const& key) const {
+    return at_key<true>(key);
+  }
+
+  left_t const& at_right(right_t const& key) const {
+    return at_key<false>(key);
+  }
+
+  template <typename K, typename C = CompareRight,
+            typename = typename C::is_transparent>
+  left_t const& at_right(K const& key) const {
+    return at_key<false>(key);
+  }
+
+  // f(left, right) for all pairs in the order of left
+  template <typename F>
+  void for_each_left(F f) const {
+    auto call = [&f](entry_t const& entry) { f(entry.left, entry.right); };
+    left_treap.for_each(call);
+  }
+
+  // f(left, right) for all pairs in the order of right
+  template <typename F>
+  void for_each_right(F f) const {
+    auto call = [&f](entry_t const& entry) { f(entry.left, entry.right); };
+    right_treap.for_each(call);
+  }
+
+  bool empty() const noexcept {
+    return size() == 0;
+  }
+
+  std::size_t size() const noexcept {
+    return left_treap.size();
+  }
+
+  allocator_type get_allocator() const noexcept {
+    return alloc;
+  }
+
+private:
+  Allocator alloc;
+  left_treap_t left_treap;
+  right_treap_t right_treap;
+
+  template <typename Compare, typename T, typename K>
+  static constexpr bool is_lookup_key_v =
+      std::is_same_v<std::decay_t<K>, T> ||
+      tree_inside::is_transparent<Compare>::value;
+
+  // the spares of both treaps are given back if there is an exception
+  template <typename left_t_, typename right_t_>
+  entry_t* create_entry(left_t_&& left, right_t_&& right) {
+    entry_allocator_t entry_alloc(alloc);
+    entry_t* entry = nullptr;
+    try {
+      entry = entry_traits::allocate(entry_alloc, 1);
+      entry_traits::construct(entry_alloc, entry, std::forward<left_t_>(left),
+                              std::forward<right_t_>(right));
+    } catch (...) {
+      if (entry != nullptr) {
+        entry_traits::deallocate(entry_alloc, entry, 1);
+      }
+      left_treap.drop_spares();
+      right_treap.drop_spares();
+      throw;
+    }
+    return entry;
+  }
+
+  bool erase_entry(entry_t const* entry) {
+    if (entry == nullptr) {
+      return false;
+    }
+
+    try {
+      left_treap.reserve_erase(entry->left);
+      right_treap.reserve_erase(entry->right);
+    } catch (...) {
+      left_treap.drop_spares();
+      right_treap.drop_spares();
+      throw;
+    }
+    // the right treap keeps the entry alive while the left one forgets it
+    left_treap.erase(entry->left);
+    right_treap.erase(entry->right);
+    return true;
+  }
+
+  template <bool by_left, typename K>
+  auto const* find_key(K const& key) const noexcept {
+    if constexpr (by_left) {
+      entry_t const* entry = left_treap.find(key);
+      return entry == nullptr ? nullptr : &entry->right;
+    } else {
+      entry_t const* entry = right_treap.find(key);
+      return entry == nullptr ? nullptr : &entry->left;
+    }
+  }
+
+  template <bool by_left, typename K>
+  auto const& at_key(K const& key) const {
+    auto const* res = find_key<by_left>(key);
+
+    if (res == nullptr)
+      throw std::out_of_range("no such element");
+
+    return *res;
+  }
+};
@@ -0,0 +1,75 @@
+// g++ -std=c++17 -fsanitize=address regression_test.cpp -o regression_test
+// ./regression_test
+//
+// cases which broke once, one function each; prints ok or fails an assert
+
+#undef NDEBUG
+#include "../frozen_bimap.h"
+#include "../hash_bimap.h"
+#include <cassert>
+#include <cstdio>
+#include <limits>
+#include <string>
+#include <string_view>
+
+// an empty map which keeps its tables must still place pairs by their hash
+void hash_insert_after_clear() {
+  hash_bimap<int, int> b;
+  b.insert(1, 1);
+  b.erase_left(1);
+  for (int i = 0; i < 8; i++) {
+    assert(b.insert(10 + i, 20 + i) != b.end_left());
+  }
+  for (int i = 0; i < 8; i++) {
+    assert(b.find_left(10 + i) != b.end_left());
+    assert(b.find_right(20 + i) != b.end_right());
+  }
+
+  b.clear();
+  assert(b.insert(100, 200) != b.end_left());
+  assert(b.insert(100, 300) == b.end_left());
+  assert(b.insert(101, 200) == b.end_left());
+  assert(b.size() == 1 && b.at_left(100) == 200);
+}
+
+// +inf is a key like any other, the padding of the last block must not
+// sort before it
+void frozen_infinite_key() {
+  double const inf = std::numeric_limits<double>::infinity();
+  for (int n = 1; n < 40; n++) {
+    bimap<double, int> source;
+    for (int i = 0; i + 1 < n; i++) {
+      source.insert(i, i);
+    }
+    source.insert(inf, n - 1);
+
+    frozen_bimap<double, int> frozen(source);
+    auto it = frozen.find_left(inf);
+    assert(it != frozen.end_left() && *it.flip() == n - 1);
+    assert(frozen.lower_bound_left(inf) == it);
+    assert(frozen.upper_bound_left(inf) == frozen.end_left());
+    if (n > 1) {
+      assert(*frozen.lower_bound_left(n - 1.5) == inf);
+    }
+  }
+}
+
+// with transparent comparators the values are made from the keys in place,
+// even by an explicit conversion
+void emplace_by_string_view() {
+  bimap<std::string, std::string, std::less<>, std::less<>> b;
+  assert(b.try_emplace(std::string_view("abc"), std::string_view("x")) !=
+         b.end_left());
+  assert(b.insert(std::string_view("def"), std::string("y")) != b.end_left());
+  assert(b.try_emplace(std::string_view("abc"), std::string_view("z")) ==
+         b.end_left());
+  assert(b.size() == 2 && b.at_left(std::string_view("abc")) == "x");
+  assert(b.at_right(std::string_view("y")) == "def");
+}
+
+int main() {
+  hash_insert_after_clear();
+  frozen_infinite_key();
+  emplace_by_string_view();
+  puts("ok");
+}
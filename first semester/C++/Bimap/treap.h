@@ -1,19 +1,152 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
+#include <future>
 #include <random>
+#include <thread>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
 template <typename Left, typename Right, typename compare_left,
-          typename compare_right>
+          typename compare_right, typename allocator, typename stats>
 struct bimap;
 
 namespace tree_inside {
 
 thread_local inline std::mt19937 rnd{};
 
+template <typename Compare, typename = void>
+struct is_transparent : std::false_type {};
+
+template <typename Compare>
+struct is_transparent<Compare, std::void_t<typename Compare::is_transparent>>
+    : std::true_type {};
+
+// the statistics policy of treap and bimap: with no_stats every hook is
+// empty and compiles to nothing
+struct no_stats {
+  enum descent { SPLIT, MERGE };
+
+  void compared() const noexcept {}
+  void descended(descent, std::size_t) const noexcept {}
+  void allocated(std::size_t) const noexcept {}
+  void deallocated(std::size_t) const noexcept {}
+};
+
+// the treap of each side counts its comparisons and the calls and the
+// deepest descent of split and merge, the bimap counts its nodes; the
+// counters are atomic since the set operations work in several threads
+struct counting_stats {
+  using descent = no_stats::descent;
+
+  counting_stats() noexcept = default;
+  counting_stats(counting_stats const&) = delete;
+  counting_stats& operator=(counting_stats const&) = delete;
+
+  std::size_t comparisons() const noexcept {
+    return comparisons_.load(std::memory_order_relaxed);
+  }
+
+  std::size_t calls(descent kind) const noexcept {
+    return calls_[kind].load(std::memory_order_relaxed);
+  }
+
+  std::size_t max_depth(descent kind) const noexcept {
+    return max_depth_[kind].load(std::memory_order_relaxed);
+  }
+
+  std::size_t allocations() const noexcept {
+    return allocations_.load(std::memory_order_relaxed);
+  }
+
+  std::size_t deallocations() const noexcept {
+    return deallocations_.load(std::memory_order_relaxed);
+  }
+
+  void reset() noexcept {
+    comparisons_ = 0;
+    allocations_ = 0;
+    deallocations_ = 0;
+    for (std::size_t kind = 0; kind < 2; kind++) {
+      calls_[kind] = 0;
+      max_depth_[kind] = 0;
+    }
+  }
+
+  void compared() const noexcept {
+    comparisons_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void descended(descent kind, std::size_t depth) const noexcept {
+    calls_[kind].fetch_add(1, std::memory_order_relaxed);
+    std::size_t deepest = max_depth_[kind].load(std::memory_order_relaxed);
+    while (deepest < depth && !max_depth_[kind].compare_exchange_weak(
+                                  deepest, depth, std::memory_order_relaxed)) {
+    }
+  }
+
+  void allocated(std::size_t count) const noexcept {
+    allocations_.fetch_add(count, std::memory_order_relaxed);
+  }
+
+  void deallocated(std::size_t count) const noexcept {
+    deallocations_.fetch_add(count, std::memory_order_relaxed);
+  }
+
+private:
+  mutable std::atomic<std::size_t> comparisons_{0};
+  mutable std::atomic<std::size_t> calls_[2]{};
+  mutable std::atomic<std::size_t> max_depth_[2]{};
+  mutable std::atomic<std::size_t> allocations_{0};
+  mutable std::atomic<std::size_t> deallocations_{0};
+};
+
+// the walks go down one link at a time, so the sons of the current node are
+// fetched while it is compared
+inline void prefetch(void const* ptr) noexcept {
+#if defined(__GNUC__)
+  __builtin_prefetch(ptr);
+#else
+  (void)ptr;
+#endif
+}
+
+// (address, index) pairs sorted by the address in linear time, to match
+// the nodes of one tree seen in two orders: LSD radix sort by bytes, the
+// bytes which are the same everywhere (usually the high ones) are skipped
+template <typename Index>
+void sort_by_address(std::vector<std::pair<std::uintptr_t, Index>>& items) {
+  std::vector<std::pair<std::uintptr_t, Index>> buffer(items.size());
+
+  for (std::size_t shift = 0; shift < 8 * sizeof(std::uintptr_t);
+       shift += 8) {
+    std::size_t count[257] = {};
+    for (auto const& item : items) {
+      count[((item.first >> shift) & 255) + 1]++;
+    }
+    if (items.empty() ||
+        count[((items[0].first >> shift) & 255) + 1] == items.size()) {
+      continue;
+    }
+
+    for (std::size_t i = 1; i < 257; i++) {
+      count[i] += count[i - 1];
+    }
+    for (auto const& item : items) {
+      buffer[count[(item.first >> shift) & 255]++] = item;
+    }
+    items.swap(buffer);
+  }
+}
+
 struct left_tag;
 struct right_tag;
+struct removed_list;
 
 struct elem_base {
   elem_base() noexcept = default;
@@ -30,24 +163,81 @@ struct elem_base {
     parent = new_parent;
   }
 
+  static std::size_t size_of(elem_base const* node) noexcept {
+    return node == nullptr ? 0 : node->size;
+  }
+
+  void update_size() noexcept {
+    size = 1 + size_of(left) + size_of(right);
+  }
+
+  // position in the in-order traversal, the fake node stands past the end
+  std::size_t index() const noexcept {
+    std::size_t res = size_of(left);
+    for (elem_base const* node = this; node->parent != nullptr;
+         node = node->parent) {
+      if (node->parent->right == node) {
+        res += size_of(node->parent->left) + 1;
+      }
+    }
+    return res;
+  }
+
+  elem_base const* fake_node() const noexcept {
+    elem_base const* node = this;
+    while (node->parent != nullptr) {
+      node = node->parent;
+    }
+    return node;
+  }
+
+  // returns the fake node if there are not enough elements
+  static elem_base const* nth(elem_base const* fake, std::size_t k) noexcept {
+    elem_base const* node = fake->left;
+
+    while (node != nullptr) {
+      std::size_t left_size = size_of(node->left);
+      if (k < left_size) {
+        node = node->left;
+      } else if (k == left_size) {
+        return node;
+      } else {
+        k -= left_size + 1;
+        node = node->right;
+      }
+    }
+    return fake;
+  }
+
   template <typename Left, typename Right, typename compare_left,
-            typename compare_right>
+            typename compare_right, typename allocator, typename stats>
   friend struct ::bimap;
 
-  template <typename T, typename Tag, typename Comp>
+  template <typename T, typename Tag, typename Comp, typename Stats>
   friend struct treap;
 
+  friend struct removed_list;
+
 private:
   elem_base* parent{nullptr};
   elem_base* left{nullptr};
   elem_base* right{nullptr};
+  std::size_t size{1};
 };
 
 template <typename T, typename Tag>
 struct elem : elem_base {
   elem() noexcept = default;
 
-  explicit elem(T val_) noexcept : val(std::move(val_)), prior(rnd()) {}
+  explicit elem(T val_) noexcept(std::is_nothrow_move_constructible_v<T>)
+      : val(std::move(val_)), prior(rnd()) {}
+
+  // the value is made in place from anything it can be made of, even by an
+  // explicit conversion (a string from a string_view)
+  template <typename T_>
+  elem(T_&& val_, uint32_t prior_) noexcept(
+      std::is_nothrow_constructible_v<T, T_&&>)
+      : val(std::forward<T_>(val_)), prior(prior_) {}
 
   ~elem() = default;
 
@@ -55,10 +245,10 @@ struct elem : elem_base {
   elem& operator=(elem const&) = delete;
 
   template <typename Left, typename Right, typename compare_left,
-            typename compare_right>
+            typename compare_right, typename allocator, typename stats>
   friend struct ::bimap;
 
-  template <typename T_, typename Tag_, typename Comp_>
+  template <typename T_, typename Tag_, typename Comp_, typename Stats_>
   friend struct treap;
 
 private:
@@ -71,14 +261,50 @@ struct bimap_node : elem<Key, left_tag>, elem<Value, right_tag> {
   bimap_node() noexcept = default;
 
   template <typename Key_, typename Value_>
-  bimap_node(Key_&& left, Value_&& right) noexcept
-      : elem<Key, left_tag>(std::forward<Key_>(left)), elem<Value, right_tag>(
-                                                           std::forward<Value_>(
-                                                               right)) {}
+  bimap_node(Key_&& left, Value_&& right)
+      : elem<Key, left_tag>(std::forward<Key_>(left), rnd()),
+        elem<Value, right_tag>(std::forward<Value_>(right), rnd()) {}
+
+  template <typename Key_, typename Value_>
+  bimap_node(Key_&& left, Value_&& right, uint32_t left_prior,
+             uint32_t right_prior)
+      : elem<Key, left_tag>(std::forward<Key_>(left), left_prior),
+        elem<Value, right_tag>(std::forward<Value_>(right), right_prior) {}
 };
 
-template <typename T, typename Tag, typename comp>
-struct treap : comp {
+// nodes taken out of a treap, linked through right,
+// a cut subtree comes in its order
+struct removed_list {
+  elem_base* head{nullptr};
+  elem_base* tail{nullptr};
+
+  void push(elem_base* node) noexcept {
+    node->parent = node->left = node->right = nullptr;
+    if (head == nullptr) {
+      head = node;
+    } else {
+      tail->right = node;
+    }
+    tail = node;
+  }
+
+  void splice(removed_list& other) noexcept {
+    if (other.head == nullptr) {
+      return;
+    }
+    if (head == nullptr) {
+      head = other.head;
+    } else {
+      tail->right = other.head;
+    }
+    tail = other.tail;
+    other.head = other.tail = nullptr;
+  }
+};
+
+template <typename T, typename Tag, typename comp,
+          typename Stats = no_stats>
+struct treap : comp, Stats {
   using treap_element_t = elem<T, Tag>;
 
   treap() noexcept = default;
@@ -100,16 +326,55 @@ struct treap : comp {
     return fake.left == nullptr;
   }
 
+  // the place for a new node: the subtree hanging on link gets split by it
+  struct position {
+    elem_base* parent;
+    elem_base** link;
+  };
+
+  // an equal element must not be in the treap
   elem_base* insert(treap_element_t& node) noexcept {
-    if (!empty()) {
-      auto [left, right] = split(node.val, get_treap_elem(fake.left));
-      treap_element_t* pointer = merge(left, &node);
-      fake.left = merge(pointer, right);
-    } else {
-      fake.left = &get_base_elem(node);
+    position pos;
+    find_position(nullptr, node.val, node.prior, pos);
+    return insert_at(pos, node);
+  }
+
+  // hint is the element which should follow val (the fake node for the end)
+  // or nullptr, returns false if there is an element equal to val
+  template <typename K>
+  bool find_position(elem_base* hint, K const& val, uint32_t prior,
+                     position& pos) noexcept {
+    if (hint == nullptr || !find_leaf_near(hint, val, pos)) {
+      return find_position(val, prior, pos);
+    }
+
+    while (pos.parent != &fake &&
+           get_treap_elem(pos.parent)->prior < prior) {
+      elem_base* up = pos.parent;
+      pos.parent = up->parent;
+      pos.link = up->is_left_son() ? &pos.parent->left : &pos.parent->right;
+    }
+    return true;
+  }
+
+  elem_base* insert_at(position const& pos, treap_element_t& node) noexcept {
+    auto [left, right] = split(node.val, get_treap_elem(*pos.link));
+
+    node.left = left;
+    node.right = right;
+    if (left != nullptr) {
+      left->change_parent(&node);
+    }
+    if (right != nullptr) {
+      right->change_parent(&node);
     }
+    node.update_size();
 
-    fake.left->parent = &fake;
+    node.parent = pos.parent;
+    *pos.link = &node;
+    for (elem_base* curr = pos.parent; curr != &fake; curr = curr->parent) {
+      curr->size++;
+    }
     return &node;
   }
 
@@ -130,58 +395,252 @@ struct treap : comp {
       obj_elem->parent->right = res;
     }
 
+    for (elem_base* node = obj_elem->parent; node->parent != nullptr;
+         node = node->parent) {
+      node->size--;
+    }
+
     obj_elem->left = obj_elem->right = obj_elem->parent = nullptr;
+    obj_elem->size = 1;
   }
 
-  bool erase_in_subtree(T const& val, treap_element_t* obj_elem) noexcept {
+  template <typename K>
+  bool erase_in_subtree(K const& val, treap_element_t* obj_elem) noexcept {
+    obj_elem = find(val, obj_elem);
     if (obj_elem == nullptr) {
       return false;
     }
-
-    if (more_or_equal(obj_elem->val, val)) {
-      erase(obj_elem);
-      return true;
-    } else if (less(obj_elem->val, val)) {
-      return erase_in_subtree(val, obj_elem->right);
-    }
-    return erase_in_subtree(val, obj_elem->left);
+    erase(obj_elem);
+    return true;
   }
 
-  bool erase(T const& val) noexcept {
+  template <typename K, typename = std::enable_if_t<
+                            !std::is_convertible_v<K const&, elem_base*>>>
+  bool erase(K const& val) noexcept {
     return erase_in_subtree(val, get_treap_elem(fake.left));
   }
 
+  // nodes must go in increasing order, treap must be empty
+  template <typename It>
+  void build(It first, It last) noexcept {
+    elem_base* rightmost = &fake;
+
+    for (; first != last; ++first) {
+      treap_element_t* node = *first;
+      elem_base* last_popped = nullptr;
+      elem_base* curr = rightmost;
+
+      while (curr != &fake && get_treap_elem(curr)->prior < node->prior) {
+        curr->update_size();
+        last_popped = curr;
+        curr = curr->parent;
+      }
+
+      node->left = last_popped;
+      node->right = nullptr;
+      node->parent = curr;
+      if (last_popped != nullptr) {
+        last_popped->change_parent(node);
+      }
+
+      if (curr == &fake) {
+        fake.left = node;
+      } else {
+        curr->right = node;
+      }
+      rightmost = node;
+    }
+
+    for (; rightmost != &fake; rightmost = rightmost->parent) {
+      rightmost->update_size();
+    }
+  }
+
   elem_base const* min() const noexcept {
     return min(&fake);
   }
 
-  treap_element_t* find(T const& val) const noexcept {
+  // found(i, elem) is called for the i-th key with its element or nullptr;
+  // large inputs are split between threads, so found is called from several
+  // threads at once
+  template <typename It, typename F>
+  void find_bulk(It first, std::size_t count, F const& found) const {
+    std::size_t threads = std::max<std::size_t>(
+        1, std::min<std::size_t>(std::thread::hardware_concurrency(),
+                                 count / PARALLEL_CUTOFF));
+    std::size_t chunk = (count + threads - 1) / threads;
+    std::vector<std::future<void>> forked;
+    forked.reserve(threads);
+
+    std::size_t from = 0;
+    try {
+      for (; from + chunk < count; from += chunk) {
+        forked.push_back(std::async(std::launch::async, [=, &found] {
+          find_interleaved(first, from, from + chunk, found);
+        }));
+      }
+    } catch (...) {
+      // no more threads, the rest is done here
+    }
+    find_interleaved(first, from, count, found);
+    for (std::future<void>& curr : forked) {
+      curr.get();
+    }
+  }
+
+  template <typename K>
+  treap_element_t* find(K const& val) const noexcept {
     return find(val, get_treap_elem(fake.left));
   }
 
-  elem_base const* upper_bound(const T& x) const noexcept {
-    return bound(
-        x, [this](const T& a, const T& b) { return more_or_equal(a, b); });
+  std::size_t size() const noexcept {
+    return elem_base::size_of(fake.left);
+  }
+
+  // number of elements less than x
+  template <typename K>
+  std::size_t rank(K const& x) const noexcept {
+    std::size_t res = 0;
+    treap_element_t const* curr_elem = get_treap_elem(fake.left);
+
+    while (curr_elem != nullptr) {
+      if (less(curr_elem->val, x)) {
+        res += elem_base::size_of(curr_elem->left) + 1;
+        curr_elem = get_treap_elem(curr_elem->right);
+      } else {
+        curr_elem = get_treap_elem(curr_elem->left);
+      }
+    }
+    return res;
+  }
+
+  elem_base const* nth(std::size_t k) const noexcept {
+    return elem_base::nth(&fake, k);
+  }
+
+  // walks the treap by the parent links, so it needs no stack
+  std::vector<std::size_t> depth_histogram() const {
+    std::vector<std::size_t> res;
+    elem_base const* prev = &fake;
+    elem_base const* curr = fake.left;
+    std::size_t depth = 0;
+
+    while (curr != nullptr && curr != &fake) {
+      elem_base const* next;
+      if (prev == curr->parent) {
+        if (res.size() == depth) {
+          res.push_back(0);
+        }
+        res[depth]++;
+        next = curr->left != nullptr    ? curr->left
+               : curr->right != nullptr ? curr->right
+                                        : curr->parent;
+      } else if (prev == curr->left && curr->right != nullptr) {
+        next = curr->right;
+      } else {
+        next = curr->parent;
+      }
+
+      if (next == curr->parent) {
+        depth--;
+      } else {
+        depth++;
+      }
+      prev = curr;
+      curr = next;
+    }
+    return res;
+  }
+
+  template <typename K>
+  elem_base const* upper_bound(const K& x) const noexcept {
+    return bound(x, [this](const K& a, const T& b) {
+      return more_or_equal(a, b);
+    });
+  }
+
+  template <typename K>
+  elem_base const* lower_bound(const K& x) const noexcept {
+    return bound(x, [this](const K& a, const T& b) { return compare(b, a); });
   }
 
-  elem_base const* lower_bound(const T& x) const noexcept {
-    return bound(x, [this](const T& a, const T& b) { return compare(b, a); });
+  // the same, but the search starts at finger (an element or the fake node)
+  // and goes up only as far as needed: O(log d) expected for the answer
+  // d positions away from finger
+  template <typename K>
+  elem_base const* upper_bound(elem_base const* finger,
+                               const K& x) const noexcept {
+    return bound_from(finger, x, [this](const K& a, const T& b) {
+      return more_or_equal(a, b);
+    });
   }
 
-  bool more_or_equal(const T& x, const T& y) const noexcept {
+  template <typename K>
+  elem_base const* lower_bound(elem_base const* finger,
+                               const K& x) const noexcept {
+    return bound_from(finger, x,
+                      [this](const K& a, const T& b) { return compare(b, a); });
+  }
+
+  template <typename X, typename Y>
+  bool more_or_equal(const X& x, const Y& y) const noexcept {
     return !compare(x, y);
   }
 
-  bool less(const T& x, const T& y) const noexcept {
+  template <typename X, typename Y>
+  bool less(const X& x, const Y& y) const noexcept {
     return compare(x, y);
   }
 
-  bool equal(const T& x, const T& y) const noexcept {
-    return !compare(x, y) && more_or_equal(x, y);
+  template <typename X, typename Y>
+  bool equal(const X& x, const Y& y) const noexcept {
+    return !compare(x, y) && more_or_equal(y, x);
+  }
+
+  // takes the elements at in-order positions [from, to) out, the two splits
+  // cost O(log n) and flattening the cut subtree O(to - from)
+  std::size_t cut(std::size_t from, std::size_t to,
+                  removed_list& removed) noexcept {
+    auto [rest, tail] = split_at(get_treap_elem(fake.left), to);
+    auto [head, middle] = split_at(rest, from);
+    std::size_t count = elem_base::size_of(middle);
+    remove_subtree(middle, removed);
+
+    fake.left = merge(head, tail);
+    if (fake.left != nullptr) {
+      fake.left->change_parent(&fake);
+    }
+    return count;
+  }
+
+  // other must not have elements equal to the ones of this treap,
+  // all its nodes move here
+  void unite(treap& other) noexcept {
+    treap_element_t* res = unite(get_treap_elem(fake.left),
+                                 get_treap_elem(other.fake.left), fork_depth());
+    other.fake.left = nullptr;
+    fake.left = res;
+    if (res != nullptr) {
+      res->change_parent(&fake);
+    }
+  }
+
+  // an element equal to some element of other stays if keep(elem, other_elem),
+  // the rest stay if keep_unmatched; keep may be called from several threads
+  template <typename Keep>
+  void filter(treap const& other, bool keep_unmatched, Keep const& keep,
+              removed_list& removed) noexcept {
+    treap_element_t* res =
+        filter(get_treap_elem(fake.left), get_treap_elem(other.fake.left),
+               keep_unmatched, keep, removed, fork_depth());
+    fake.left = res;
+    if (res != nullptr) {
+      res->change_parent(&fake);
+    }
   }
 
   template <typename Left, typename Right, typename compare_left,
-            typename compare_right>
+            typename compare_right, typename allocator, typename stats>
   friend struct ::bimap;
 
   void swap(treap& other) noexcept {
@@ -214,7 +673,9 @@ private:
     return static_cast<comp const&>(*this);
   }
 
-  bool compare(const T& x, const T& y) const noexcept {
+  template <typename X, typename Y>
+  bool compare(const X& x, const Y& y) const noexcept {
+    Stats::compared();
     return get_cmp()(x, y);
   }
 
@@ -226,12 +687,358 @@ private:
     return static_cast<treap_element_t*>(base);
   }
 
-  template <typename F>
-  elem_base const* bound(const T& x, F&& check_bound) const noexcept {
+  static treap_element_t const* get_treap_elem(elem_base const* base) noexcept {
+    return static_cast<treap_element_t const*>(base);
+  }
+
+  // subtrees smaller than this are not worth a thread
+  static constexpr std::size_t PARALLEL_CUTOFF = 1 << 14;
+
+  static std::size_t fork_depth() noexcept {
+    std::size_t depth = 0;
+    while ((std::size_t(1) << depth) < std::thread::hardware_concurrency()) {
+      depth++;
+    }
+    return depth;
+  }
+
+  template <typename F, typename G>
+  static void fork_join(bool parallel, F const& first, G const& second) {
+    if (parallel) {
+      std::future<void> forked;
+      try {
+        forked = std::async(std::launch::async, [&first] { first(); });
+      } catch (...) {
+        parallel = false;
+      }
+      if (parallel) {
+        second();
+        forked.get();
+        return;
+      }
+    }
+    first();
+    second();
+  }
+
+  struct split_result {
+    treap_element_t* less;
+    treap_element_t* equal;
+    treap_element_t* greater;
+  };
+
+  // the two results of a split being built top-down: a node going to less
+  // keeps its left son and waits for the right one, and the other way round
+  struct split_links {
+    elem_base* less{nullptr};
+    elem_base* greater{nullptr};
+
+    split_links() noexcept = default;
+    split_links(split_links const&) = delete;
+    split_links& operator=(split_links const&) = delete;
+
+    // these return the son to go down to
+    elem_base* to_less(elem_base* node) noexcept {
+      attach(less_link, less_last, node);
+      less_link = &node->right;
+      return node->right;
+    }
+
+    elem_base* to_greater(elem_base* node) noexcept {
+      attach(greater_link, greater_last, node);
+      greater_link = &node->left;
+      return node->left;
+    }
+
+    // hangs the last subtrees and fixes the sizes of the nodes on the path
+    void finish(elem_base* less_rest, elem_base* greater_rest) noexcept {
+      attach(less_link, less_last, less_rest);
+      attach(greater_link, greater_last, greater_rest);
+      for (elem_base* node = less_last; node != nullptr; node = node->parent) {
+        node->update_size();
+      }
+      for (elem_base* node = greater_last; node != nullptr;
+           node = node->parent) {
+        node->update_size();
+      }
+    }
+
+  private:
+    elem_base** less_link{&less};
+    elem_base** greater_link{&greater};
+    elem_base* less_last{nullptr};
+    elem_base* greater_last{nullptr};
+
+    static void attach(elem_base**& link, elem_base*& last,
+                       elem_base* node) noexcept {
+      *link = node;
+      if (node != nullptr) {
+        node->parent = last;
+        last = node;
+      }
+    }
+  };
+
+  // the splits and merge go down once and link the nodes into the results
+  // on the way, the sizes are fixed on the way back up by the parent links;
+  // the roots of the results get no parent
+  template <typename K>
+  split_result split_equal(K const& x, treap_element_t* node) noexcept {
+    split_links links;
+    treap_element_t* equal = nullptr;
+    std::size_t depth = 0;
+
+    while (node != nullptr) {
+      prefetch(node->left);
+      prefetch(node->right);
+      depth++;
+      if (less(node->val, x)) {
+        node = get_treap_elem(links.to_less(node));
+      } else if (less(x, node->val)) {
+        node = get_treap_elem(links.to_greater(node));
+      } else {
+        equal = node;
+        break;
+      }
+    }
+
+    if (equal == nullptr) {
+      links.finish(nullptr, nullptr);
+    } else {
+      links.finish(equal->left, equal->right);
+      equal->left = equal->right = equal->parent = nullptr;
+      equal->update_size();
+    }
+    Stats::descended(no_stats::SPLIT, depth);
+    return {get_treap_elem(links.less), equal,
+            get_treap_elem(links.greater)};
+  }
+
+  treap_element_t* unite(treap_element_t* first, treap_element_t* second,
+                         std::size_t depth) noexcept {
+    if (first == nullptr) {
+      return second;
+    }
+    if (second == nullptr) {
+      return first;
+    }
+    if (first->prior < second->prior) {
+      std::swap(first, second);
+    }
+
+    bool parallel = depth > 0 && first->size >= PARALLEL_CUTOFF &&
+                    second->size >= PARALLEL_CUTOFF;
+    split_result parts = split_equal(first->val, second);
+    treap_element_t* left_res = get_treap_elem(first->left);
+    treap_element_t* right_res = get_treap_elem(first->right);
+    std::size_t next_depth = parallel ? depth - 1 : depth;
+
+    fork_join(
+        parallel,
+        [&] { left_res = unite(left_res, parts.less, next_depth); },
+        [&] { right_res = unite(right_res, parts.greater, next_depth); });
+
+    first->left = left_res;
+    first->right = right_res;
+    if (left_res != nullptr) {
+      left_res->change_parent(first);
+    }
+    if (right_res != nullptr) {
+      right_res->change_parent(first);
+    }
+    first->update_size();
+    return first;
+  }
+
+  // flattens the subtree with rotations, so it needs no extra memory
+  static void remove_subtree(elem_base* node, removed_list& removed) noexcept {
+    while (node != nullptr) {
+      if (node->left != nullptr) {
+        elem_base* son = node->left;
+        node->left = son->right;
+        son->right = node;
+        node = son;
+      } else {
+        elem_base* next = node->right;
+        removed.push(node);
+        node = next;
+      }
+    }
+  }
+
+  // the first k elements and the rest
+  std::pair<treap_element_t*, treap_element_t*>
+  split_at(treap_element_t* node, std::size_t k) noexcept {
+    split_links links;
+    std::size_t depth = 0;
+
+    while (node != nullptr) {
+      prefetch(node->left);
+      prefetch(node->right);
+      depth++;
+      std::size_t left_size = elem_base::size_of(node->left);
+      if (k <= left_size) {
+        node = get_treap_elem(links.to_greater(node));
+      } else {
+        k -= left_size + 1;
+        node = get_treap_elem(links.to_less(node));
+      }
+    }
+
+    links.finish(nullptr, nullptr);
+    Stats::descended(no_stats::SPLIT, depth);
+    return {get_treap_elem(links.less), get_treap_elem(links.greater)};
+  }
+
+  template <typename Keep>
+  treap_element_t* filter(treap_element_t* node, treap_element_t const* other,
+                          bool keep_unmatched, Keep const& keep,
+                          removed_list& removed, std::size_t depth) noexcept {
+    if (node == nullptr) {
+      return nullptr;
+    }
+    if (other == nullptr) {
+      if (keep_unmatched) {
+        return node;
+      }
+      remove_subtree(node, removed);
+      return nullptr;
+    }
+
+    bool parallel = depth > 0 && node->size >= PARALLEL_CUTOFF &&
+                    other->size >= PARALLEL_CUTOFF;
+    split_result parts = split_equal(other->val, node);
+    treap_element_t* left_res = nullptr;
+    treap_element_t* right_res = nullptr;
+    removed_list forked_removed;
+    std::size_t next_depth = parallel ? depth - 1 : depth;
+
+    fork_join(
+        parallel,
+        [&] {
+          left_res = filter(parts.less, get_treap_elem(other->left),
+                            keep_unmatched, keep, forked_removed, next_depth);
+        },
+        [&] {
+          right_res = filter(parts.greater, get_treap_elem(other->right),
+                             keep_unmatched, keep, removed, next_depth);
+        });
+    removed.splice(forked_removed);
+
+    if (parts.equal != nullptr) {
+      if (keep(parts.equal, other)) {
+        return merge(merge(left_res, parts.equal), right_res);
+      }
+      removed.push(parts.equal);
+    }
+    return merge(left_res, right_res);
+  }
+
+  template <typename K>
+  bool find_position(K const& val, uint32_t prior, position& pos) noexcept {
+    pos = {&fake, &fake.left};
+    bool placed = false;
+    elem_base* curr = fake.left;
+
+    while (curr != nullptr) {
+      prefetch(curr->left);
+      prefetch(curr->right);
+      treap_element_t* curr_elem = get_treap_elem(curr);
+      if (curr_elem->prior < prior) {
+        placed = true;
+      }
+
+      elem_base** next_link;
+      if (less(curr_elem->val, val)) {
+        next_link = &curr->right;
+      } else if (less(val, curr_elem->val)) {
+        next_link = &curr->left;
+      } else {
+        return false;
+      }
+
+      if (!placed) {
+        pos = {curr, next_link};
+      }
+      curr = *next_link;
+    }
+    return true;
+  }
+
+  // finds the empty link between hint and its predecessor,
+  // false if val doesn't fit there
+  template <typename K>
+  bool find_leaf_near(elem_base* hint, K const& val,
+                      position& pos) noexcept {
+    if (hint != &fake && !less(val, get_treap_elem(hint)->val)) {
+      return false;
+    }
+
+    if (hint->left != nullptr) {
+      elem_base* pred = hint->left;
+      while (pred->right != nullptr) {
+        pred = pred->right;
+      }
+      if (!less(get_treap_elem(pred)->val, val)) {
+        return false;
+      }
+      pos = {pred, &pred->right};
+      return true;
+    }
+
+    if (hint != &fake) {
+      elem_base* curr = hint;
+      while (curr->parent != &fake && curr->is_left_son()) {
+        curr = curr->parent;
+      }
+      if (curr->parent != &fake &&
+          !less(get_treap_elem(curr->parent)->val, val)) {
+        return false;
+      }
+    }
+    pos = {hint, &hint->left};
+    return true;
+  }
+
+  template <typename K, typename F>
+  elem_base const* bound(const K& x, F&& check_bound) const noexcept {
+    return bound_in(fake.left, &fake, x, check_bound);
+  }
+
+  // the elements on the way up from finger are on one side of x until the
+  // first one that is not, the answer is in the subtree below it
+  template <typename K, typename F>
+  elem_base const* bound_from(elem_base const* finger, const K& x,
+                              F&& check_bound) const noexcept {
+    if (finger == &fake) {
+      return bound(x, check_bound);
+    }
+
+    bool after = check_bound(x, get_treap_elem(finger)->val);
+    elem_base const* curr = finger;
     elem_base const* elem = &fake;
-    treap_element_t const* curr_elem = get_treap_elem(fake.left);
+    while (curr->parent != &fake) {
+      elem_base const* parent = curr->parent;
+      if (check_bound(x, get_treap_elem(parent)->val) != after) {
+        if (after) {
+          elem = parent;
+        }
+        break;
+      }
+      curr = parent;
+    }
+    return bound_in(curr, elem, x, check_bound);
+  }
+
+  // elem is the answer if there is none in the subtree of node
+  template <typename K, typename F>
+  elem_base const* bound_in(elem_base const* node, elem_base const* elem,
+                            const K& x, F&& check_bound) const noexcept {
+    treap_element_t const* curr_elem = get_treap_elem(node);
 
     while (curr_elem != nullptr) {
+      prefetch(curr_elem->left);
+      prefetch(curr_elem->right);
       if (!check_bound(x, curr_elem->val)) {
         elem = curr_elem;
         curr_elem = get_treap_elem(curr_elem->left);
@@ -243,20 +1050,66 @@ private:
     return elem;
   }
 
-  treap_element_t* find(T const& val, treap_element_t* node) const noexcept {
-    if (node == nullptr) {
-      return nullptr;
+  // keys from..to are searched BULK_WALKS at a time: each walk goes down one
+  // level in turn and prefetches its next node, so the cache misses of the
+  // walks overlap
+  static constexpr std::size_t BULK_WALKS = 8;
+
+  template <typename It, typename F>
+  void find_interleaved(It first, std::size_t from, std::size_t to,
+                        F const& found) const {
+    treap_element_t const* root = get_treap_elem(fake.left);
+    treap_element_t const* node[BULK_WALKS];
+    std::size_t key[BULK_WALKS];
+    std::size_t active = 0;
+    for (; active < BULK_WALKS && from < to; active++, from++) {
+      node[active] = root;
+      key[active] = from;
     }
 
-    if (less(node->val, val)) {
-      return find(val, get_treap_elem(node->right));
-    } else if (more_or_equal(val, node->val)) {
-      return node;
-    } else {
-      return find(val, get_treap_elem(node->left));
+    while (active > 0) {
+      for (std::size_t i = 0; i < active;) {
+        treap_element_t const* curr = node[i];
+        auto const& val = first[key[i]];
+        if (curr != nullptr && less(curr->val, val)) {
+          node[i] = get_treap_elem(curr->right);
+        } else if (curr != nullptr && less(val, curr->val)) {
+          node[i] = get_treap_elem(curr->left);
+        } else {
+          found(key[i], curr);
+          if (from < to) {
+            node[i] = root;
+            key[i] = from++;
+            i++;
+          } else {
+            active--;
+            node[i] = node[active];
+            key[i] = key[active];
+          }
+          continue;
+        }
+        prefetch(node[i]);
+        i++;
+      }
     }
   }
 
+  template <typename K>
+  treap_element_t* find(K const& val, treap_element_t* node) const noexcept {
+    while (node != nullptr) {
+      prefetch(node->left);
+      prefetch(node->right);
+      if (less(node->val, val)) {
+        node = get_treap_elem(node->right);
+      } else if (more_or_equal(val, node->val)) {
+        return node;
+      } else {
+        node = get_treap_elem(node->left);
+      }
+    }
+    return nullptr;
+  }
+
   static elem_base const* min(elem_base const* obj_elem) noexcept {
     elem_base const* pointer = obj_elem;
     while (pointer->left != nullptr) {
@@ -267,66 +1120,61 @@ private:
 
   treap_element_t* merge(treap_element_t* first,
                          treap_element_t* second) noexcept {
-    if (first == nullptr) {
-      return second;
+    elem_base* res = nullptr;
+    elem_base** link = &res;
+    elem_base* parent = nullptr;
+    std::size_t depth = 0;
+
+    while (first != nullptr && second != nullptr) {
+      depth++;
+      if (first->prior < second->prior) {
+        prefetch(second->left);
+        *link = second;
+        second->parent = parent;
+        parent = second;
+        link = &second->left;
+        second = get_treap_elem(second->left);
+      } else {
+        prefetch(first->right);
+        *link = first;
+        first->parent = parent;
+        parent = first;
+        link = &first->right;
+        first = get_treap_elem(first->right);
+      }
     }
 
-    if (second == nullptr) {
-      return first;
+    elem_base* rest = first != nullptr ? first : second;
+    *link = rest;
+    if (rest != nullptr) {
+      rest->parent = parent;
     }
-
-    if (first->prior < second->prior) {
-      elem_base* res = merge(first, get_treap_elem(second->left));
-      second->left = res;
-      if (res != nullptr) {
-        res->change_parent(second);
-      }
-      return second;
-    } else {
-      elem_base* res = merge(get_treap_elem(first->right), second);
-      first->right = res;
-      if (res != nullptr) {
-        res->change_parent(first);
-      }
-      return first;
+    for (; parent != nullptr; parent = parent->parent) {
+      parent->update_size();
     }
+    Stats::descended(no_stats::MERGE, depth);
+    return get_treap_elem(res);
   }
 
   std::pair<treap_element_t*, treap_element_t*>
   split(T& x, treap_element_t* obj_elem) noexcept {
-    if (obj_elem == nullptr) {
-      return {nullptr, nullptr};
-    }
-
-    if (less(obj_elem->val, x)) {
-      std::pair<elem_base*, elem_base*> split_obj_elems =
-          split(x, get_treap_elem(obj_elem->right));
-      obj_elem->right = split_obj_elems.first;
-
-      if (split_obj_elems.first != nullptr) {
-        split_obj_elems.first->change_parent(obj_elem);
-      }
-
-      if (split_obj_elems.second != nullptr) {
-        split_obj_elems.second->change_parent(nullptr);
-      }
-
-      return {obj_elem, get_treap_elem(split_obj_elems.second)};
-    } else {
-      std::pair<elem_base*, elem_base*> split_obj_elems =
-          split(x, get_treap_elem(obj_elem->left));
-      obj_elem->left = split_obj_elems.second;
-
-      if (split_obj_elems.second != nullptr) {
-        split_obj_elems.second->change_parent(obj_elem);
-      }
-
-      if (split_obj_elems.first != nullptr) {
-        split_obj_elems.first->change_parent(nullptr);
+    split_links links;
+    std::size_t depth = 0;
+
+    while (obj_elem != nullptr) {
+      prefetch(obj_elem->left);
+      prefetch(obj_elem->right);
+      depth++;
+      if (less(obj_elem->val, x)) {
+        obj_elem = get_treap_elem(links.to_less(obj_elem));
+      } else {
+        obj_elem = get_treap_elem(links.to_greater(obj_elem));
       }
-
-      return {get_treap_elem(split_obj_elems.first), obj_elem};
     }
+
+    links.finish(nullptr, nullptr);
+    Stats::descended(no_stats::SPLIT, depth);
+    return {get_treap_elem(links.less), get_treap_elem(links.greater)};
   }
 };
 } // namespace tree_inside
@@ -0,0 +1,166 @@
+// gcc -std=c99 -O2 -DZLIB -DLIBDEFLATE inflate_bench.c -o inflate_bench -lz -ldeflate
+// (add -DISAL -lisal if it is installed)
+// ./inflate_bench
+//
+// MB/s of inflated image data per backend built in, over generated RGB
+// images of several sizes compressed at several levels: the whole stream at
+// once, and by 64 KiB pieces of IDAT as the converter feeds it; every
+// result is checked against the image
+
+#define _POSIX_C_SOURCE 199309L
+#ifndef ZLIB
+	#error the images are compressed with zlib
+#endif
+#include "../inflate.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define PIECE 65536
+
+double seconds(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+// scanlines behind Sub filter bytes of a smooth gradient with some noise,
+// which compresses about as well as a photo does
+void make_image(unsigned char* image, int width, int height)
+{
+	size_t row_size = (size_t)width * 3 + 1;
+	srand(1);
+	for (int y = 0; y < height; y++)
+	{
+		unsigned char* row = image + y * row_size;
+		row[0] = 1;
+		for (int x = 0; x < width; x++)
+		{
+			for (int c = 0; c < 3; c++)
+			{
+				int value = (x * (c + 1) + y * (3 - c)) / 8 + rand() % 8;
+				row[1 + x * 3 + c] = (unsigned char)value;
+			}
+		}
+		for (size_t i = row_size - 1; i > 3; i--)
+		{
+			row[i] -= row[i - 3];
+		}
+	}
+}
+
+int inflate_by_pieces(struct inflater* inf, const unsigned char* in, size_t in_len, unsigned char* out, size_t out_len)
+{
+	inf->backend->reset(inf);
+	while (in_len > 0)
+	{
+		size_t part = in_len < PIECE ? in_len : PIECE;
+		size_t left = part;
+		int res = INFLATE_OK;
+		while (left > 0 && res == INFLATE_OK)
+		{
+			size_t in_before = left;
+			size_t out_before = out_len;
+			res = inf->backend->stream(inf, &in, &left, &out, &out_len);
+			if (res == INFLATE_OK && left == in_before && out_len == out_before)
+			{
+				return INFLATE_BAD_DATA;
+			}
+		}
+		in_len -= part - left;
+		if (res != INFLATE_OK)
+		{
+			return res == INFLATE_END && out_len == 0 ? INFLATE_OK : INFLATE_BAD_DATA;
+		}
+	}
+	return INFLATE_BAD_DATA;
+}
+
+int main(void)
+{
+	const int sizes[3][2] = { { 256, 256 }, { 1024, 1024 }, { 4096, 2048 } };
+	const int levels[3] = { 1, 6, 9 };
+
+	printf("width,height,level,ratio,backend,whole MB/s,pieces MB/s\n");
+	for (int s = 0; s < 3; s++)
+	{
+		int width = sizes[s][0];
+		int height = sizes[s][1];
+		size_t size = ((size_t)width * 3 + 1) * height;
+		uLongf bound = compressBound((uLong)size);
+		unsigned char* image = (unsigned char*)malloc(size);
+		unsigned char* out = (unsigned char*)malloc(size);
+		unsigned char* packed = (unsigned char*)malloc(bound);
+		if (image == NULL || out == NULL || packed == NULL)
+		{
+			fprintf(stderr, "not enough memory\n");
+			return 1;
+		}
+		make_image(image, width, height);
+		// about a second of inflating at 200 MB/s per measurement
+		int reps = (int)(200000000 / size) + 1;
+
+		for (int l = 0; l < 3; l++)
+		{
+			uLongf packed_size = bound;
+			if (compress2(packed, &packed_size, image, (uLong)size, levels[l]) != Z_OK)
+			{
+				fprintf(stderr, "can't compress\n");
+				return 1;
+			}
+
+			for (size_t b = 0; b < INFLATE_BACKEND_COUNT; b++)
+			{
+				const struct inflate_backend* backend = &inflate_backends[b];
+				struct inflater inf;
+				if (inflate_open(&inf, backend) != INFLATE_OK)
+				{
+					fprintf(stderr, "not enough memory\n");
+					return 1;
+				}
+
+				double best[2] = { 1e9, 1e9 };
+				for (int k = 0; k < 2; k++)
+				{
+					if (k == 1 && backend->stream == NULL)
+					{
+						continue;
+					}
+					for (int r = 0; r < reps; r++)
+					{
+						memset(out, 0, size);
+						double start = seconds();
+						int res = k == 0 ? backend->whole(&inf, packed, packed_size, out, size)
+										 : inflate_by_pieces(&inf, packed, packed_size, out, size);
+						double time = seconds() - start;
+						best[k] = time < best[k] ? time : best[k];
+						if (res != INFLATE_OK || memcmp(out, image, size) != 0)
+						{
+							printf("wrong result: %s, %dx%d, level %d\n", backend->name, width, height, levels[l]);
+							return 1;
+						}
+					}
+				}
+				inflate_close(&inf);
+
+				printf("%d,%d,%d,%.2f,%s,%.1f,", width, height, levels[l], (double)size / packed_size, backend->name,
+					   size / best[0] * 1e-6);
+				if (backend->stream != NULL)
+				{
+					printf("%.1f\n", size / best[1] * 1e-6);
+				}
+				else
+				{
+					printf("-\n");
+				}
+			}
+		}
+
+		free(image);
+		free(out);
+		free(packed);
+	}
+	return 0;
+}
@@ -0,0 +1,168 @@
+// gcc -std=c99 -O2 unfilter_bench.c -o unfilter_bench
+// ./unfilter_bench [width] [height]
+//
+// GB/s of unfiltered data per filter type and bytes per pixel: the old
+// per-byte fill_line, the scalar kernels and the simd ones; every result is
+// checked against fill_line
+
+#define _POSIX_C_SOURCE 199309L
+#include "../unfilter.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// the converter's fill_line before the kernels, on the whole inflated image,
+// for any bytes per pixel
+int abss(int x, int y)
+{
+	return (x > y) ? x - y : y - x;
+}
+
+void fill_line(unsigned char* buffer, int filter_type, long ind, int width, int bytes)
+{
+	for (int i = 1; i <= width; i++)
+	{
+		int bpp = i > bytes ? buffer[ind * (width + 1) + i - bytes] : 0;
+		int upper = ind > 0 ? buffer[(ind - 1) * (width + 1) + i] : 0;
+		int bpp_upper = i > bytes && ind > 0 ? buffer[(ind - 1) * (width + 1) + i - bytes] : 0;
+
+		if (filter_type == 0)
+		{
+			continue;
+		}
+		else if (filter_type == 1)
+		{
+			buffer[ind * (width + 1) + i] += bpp;
+		}
+		else if (filter_type == 2)
+		{
+			buffer[ind * (width + 1) + i] += upper;
+		}
+		else if (filter_type == 3)
+		{
+			buffer[ind * (width + 1) + i] += (bpp + upper) / 2;
+		}
+		else if (filter_type == 4)
+		{
+			int p = bpp + upper - bpp_upper;
+			int pa = abss(p, bpp);
+			int pb = abss(p, upper);
+			int pc = abss(p, bpp_upper);
+			if (pa <= pb && pa <= pc)
+			{
+				p = bpp;
+			}
+			else if (pb <= pc)
+			{
+				p = upper;
+			}
+			else
+			{
+				p = bpp_upper;
+			}
+			buffer[ind * (width + 1) + i] += p;
+		}
+	}
+}
+
+double seconds(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+void run_old(unsigned char* image, int width, int height, int bpp)
+{
+	for (int i = 0; i < height; i++)
+	{
+		fill_line(image, image[(long)i * (width + 1)], i, width, bpp);
+	}
+}
+
+void run_kernels(unsigned char* image, size_t row_size, int height, unfilter_fn* kernels, const unsigned char* zero)
+{
+	const unsigned char* prev = zero;
+	for (int i = 0; i < height; i++)
+	{
+		unsigned char* row = image + i * row_size;
+		kernels[row[0]](row + 1, prev + 1, row_size - 1);
+		prev = row;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	int pixels = argc > 1 ? atoi(argv[1]) : 4096;
+	int height = argc > 2 ? atoi(argv[2]) : 512;
+	const char* names[5] = { "none", "sub", "up", "avg", "paeth" };
+	const int bpps[6] = { 1, 2, 3, 4, 6, 8 };
+	int reps = 10;
+
+	printf("filter,bpp,fill_line GB/s,scalar GB/s,simd GB/s\n");
+	for (int b = 0; b < 6; b++)
+	{
+		int bpp = bpps[b];
+		int width = pixels * bpp;
+		size_t row_size = (size_t)width + 1;
+		size_t size = row_size * height;
+		unsigned char* source = (unsigned char*)malloc(size);
+		unsigned char* expected = (unsigned char*)malloc(size);
+		unsigned char* image = (unsigned char*)malloc(size);
+		unsigned char* zero = (unsigned char*)calloc(row_size, 1);
+		if (source == NULL || expected == NULL || image == NULL || zero == NULL)
+		{
+			fprintf(stderr, "not enough memory\n");
+			return 1;
+		}
+
+		unfilter_fn scalar[5];
+		unfilter_fn simd[5];
+		unfilter_choose(bpp, 0, scalar);
+		unfilter_choose(bpp, 1, simd);
+
+		srand(1);
+		for (int filter = 1; filter <= 4; filter++)
+		{
+			for (size_t i = 0; i < size; i++)
+			{
+				source[i] = (unsigned char)(i % row_size == 0 ? filter : rand());
+			}
+
+			double best[3] = { 1e9, 1e9, 1e9 };
+			for (int r = 0; r < reps; r++)
+			{
+				memcpy(expected, source, size);
+				double start = seconds();
+				run_old(expected, width, height, bpp);
+				double time = seconds() - start;
+				best[0] = time < best[0] ? time : best[0];
+
+				for (int k = 0; k < 2; k++)
+				{
+					memcpy(image, source, size);
+					start = seconds();
+					run_kernels(image, row_size, height, k == 0 ? scalar : simd, zero);
+					time = seconds() - start;
+					best[k + 1] = time < best[k + 1] ? time : best[k + 1];
+					if (memcmp(image, expected, size) != 0)
+					{
+						printf("wrong result: %s, bpp %d, %s\n", names[filter], bpp, k == 0 ? "scalar" : "simd");
+						return 1;
+					}
+				}
+			}
+
+			double bytes = (double)width * height;
+			printf("%s,%d,%.2f,%.2f,%.2f\n", names[filter], bpp, bytes / best[0] * 1e-9, bytes / best[1] * 1e-9,
+				   bytes / best[2] * 1e-9);
+		}
+
+		free(source);
+		free(expected);
+		free(image);
+		free(zero);
+	}
+	return 0;
+}
@@ -0,0 +1,267 @@
+#ifndef INFLATE_H
+#define INFLATE_H
+
+#include <stddef.h>
+#include <string.h>
+
+// zlib stream decompression behind one interface for every backend built in:
+// define any set of ZLIB, LIBDEFLATE and ISAL before including this. A
+// context is opened once and reset for every stream, so its tables and
+// window are allocated once however many images go through it
+
+#if !defined(ZLIB) && !defined(LIBDEFLATE) && !defined(ISAL)
+	#error wrong macros
+#endif
+
+#ifdef ZLIB
+	#include <zlib.h>
+#endif
+
+#ifdef LIBDEFLATE
+	#include <libdeflate.h>
+#endif
+
+#ifdef ISAL
+	#include <include/igzip_lib.h>
+#endif
+
+enum inflate_result
+{
+	INFLATE_OK,
+	// the end of the zlib stream is reached
+	INFLATE_END,
+	INFLATE_BAD_DATA,
+	INFLATE_NO_MEMORY
+};
+
+struct inflate_backend;
+
+struct inflater
+{
+	const struct inflate_backend* backend;
+#ifdef ZLIB
+	z_stream stream;
+#endif
+#ifdef LIBDEFLATE
+	struct libdeflate_decompressor* decompressor;
+#endif
+#ifdef ISAL
+	struct inflate_state state;
+#endif
+};
+
+struct inflate_backend
+{
+	const char* name;
+	int (*open)(struct inflater* inf);
+	void (*close)(struct inflater* inf);
+	// the next stream starts from scratch
+	void (*reset)(struct inflater* inf);
+	// inflates from in to out as much as fits and moves both past what is
+	// done; NULL if the backend can only inflate a whole stream at once
+	int (*stream)(struct inflater* inf, const unsigned char** in, size_t* in_len, unsigned char** out, size_t* out_len);
+	// inflates the whole stream, which must give out_len bytes exactly
+	int (*whole)(struct inflater* inf, const unsigned char* in, size_t in_len, unsigned char* out, size_t out_len);
+};
+
+// the inflaters count in 32 bits
+#define INFLATE_PART_LIMIT 0x40000000
+
+// whole for the streaming backends
+static inline int inflate_whole_by_parts(struct inflater* inf, const unsigned char* in, size_t in_len, unsigned char* out, size_t out_len)
+{
+	inf->backend->reset(inf);
+	for (;;)
+	{
+		size_t in_before = in_len;
+		size_t out_before = out_len;
+		int res = inf->backend->stream(inf, &in, &in_len, &out, &out_len);
+		if (res == INFLATE_END)
+		{
+			return out_len == 0 ? INFLATE_OK : INFLATE_BAD_DATA;
+		}
+		if (res != INFLATE_OK)
+		{
+			return res;
+		}
+		// out is full while the stream goes on, or the input ended before it
+		if (in_len == in_before && out_len == out_before)
+		{
+			return INFLATE_BAD_DATA;
+		}
+	}
+}
+
+#ifdef ZLIB
+
+static int inflate_zlib_open(struct inflater* inf)
+{
+	memset(&inf->stream, 0, sizeof(inf->stream));
+	int res = inflateInit(&inf->stream);
+	return res == Z_OK ? INFLATE_OK : res == Z_MEM_ERROR ? INFLATE_NO_MEMORY : INFLATE_BAD_DATA;
+}
+
+static void inflate_zlib_close(struct inflater* inf)
+{
+	inflateEnd(&inf->stream);
+}
+
+static void inflate_zlib_reset(struct inflater* inf)
+{
+	inflateReset(&inf->stream);
+}
+
+static int inflate_zlib_stream(struct inflater* inf, const unsigned char** in, size_t* in_len, unsigned char** out, size_t* out_len)
+{
+	uInt in_part = (uInt)(*in_len < INFLATE_PART_LIMIT ? *in_len : INFLATE_PART_LIMIT);
+	uInt out_part = (uInt)(*out_len < INFLATE_PART_LIMIT ? *out_len : INFLATE_PART_LIMIT);
+	inf->stream.next_in = (Bytef*)*in;
+	inf->stream.avail_in = in_part;
+	inf->stream.next_out = *out;
+	inf->stream.avail_out = out_part;
+	int res = inflate(&inf->stream, Z_NO_FLUSH);
+
+	*in += in_part - inf->stream.avail_in;
+	*in_len -= in_part - inf->stream.avail_in;
+	*out += out_part - inf->stream.avail_out;
+	*out_len -= out_part - inf->stream.avail_out;
+	if (res == Z_STREAM_END)
+	{
+		return INFLATE_END;
+	}
+	if (res == Z_OK || res == Z_BUF_ERROR)
+	{
+		return INFLATE_OK;
+	}
+	return res == Z_MEM_ERROR ? INFLATE_NO_MEMORY : INFLATE_BAD_DATA;
+}
+
+#endif
+
+#ifdef LIBDEFLATE
+
+static int inflate_libdeflate_open(struct inflater* inf)
+{
+	inf->decompressor = libdeflate_alloc_decompressor();
+	return inf->decompressor != NULL ? INFLATE_OK : INFLATE_NO_MEMORY;
+}
+
+static void inflate_libdeflate_close(struct inflater* inf)
+{
+	libdeflate_free_decompressor(inf->decompressor);
+	inf->decompressor = NULL;
+}
+
+// every call is a stream of its own
+static void inflate_libdeflate_reset(struct inflater* inf)
+{
+	(void)inf;
+}
+
+static int inflate_libdeflate_whole(struct inflater* inf, const unsigned char* in, size_t in_len, unsigned char* out, size_t out_len)
+{
+	size_t actual = 0;
+	enum libdeflate_result res = libdeflate_zlib_decompress(inf->decompressor, in, in_len, out, out_len, &actual);
+	return res == LIBDEFLATE_SUCCESS && actual == out_len ? INFLATE_OK : INFLATE_BAD_DATA;
+}
+
+#endif
+
+#ifdef ISAL
+
+static int inflate_isal_open(struct inflater* inf)
+{
+	isal_inflate_init(&inf->state);
+	inf->state.crc_flag = IGZIP_ZLIB;
+	return INFLATE_OK;
+}
+
+static void inflate_isal_close(struct inflater* inf)
+{
+	(void)inf;
+}
+
+static void inflate_isal_reset(struct inflater* inf)
+{
+	isal_inflate_reset(&inf->state);
+	inf->state.crc_flag = IGZIP_ZLIB;
+}
+
+static int inflate_isal_stream(struct inflater* inf, const unsigned char** in, size_t* in_len, unsigned char** out, size_t* out_len)
+{
+	uint32_t in_part = (uint32_t)(*in_len < INFLATE_PART_LIMIT ? *in_len : INFLATE_PART_LIMIT);
+	uint32_t out_part = (uint32_t)(*out_len < INFLATE_PART_LIMIT ? *out_len : INFLATE_PART_LIMIT);
+	inf->state.next_in = (uint8_t*)*in;
+	inf->state.avail_in = in_part;
+	inf->state.next_out = *out;
+	inf->state.avail_out = out_part;
+	int res = isal_inflate(&inf->state);
+
+	*in += in_part - inf->state.avail_in;
+	*in_len -= in_part - inf->state.avail_in;
+	*out += out_part - inf->state.avail_out;
+	*out_len -= out_part - inf->state.avail_out;
+	if (res < 0)
+	{
+		return INFLATE_BAD_DATA;
+	}
+	return inf->state.block_state == ISAL_BLOCK_FINISH ? INFLATE_END : INFLATE_OK;
+}
+
+#endif
+
+// fastest first by bench/inflate_bench.c
+static const struct inflate_backend inflate_backends[] = {
+#ifdef ISAL
+	{ "isal", inflate_isal_open, inflate_isal_close, inflate_isal_reset, inflate_isal_stream, inflate_whole_by_parts },
+#endif
+#ifdef LIBDEFLATE
+	{ "libdeflate", inflate_libdeflate_open, inflate_libdeflate_close, inflate_libdeflate_reset, NULL, inflate_libdeflate_whole },
+#endif
+#ifdef ZLIB
+	{ "zlib", inflate_zlib_open, inflate_zlib_close, inflate_zlib_reset, inflate_zlib_stream, inflate_whole_by_parts },
+#endif
+};
+
+#define INFLATE_BACKEND_COUNT (sizeof(inflate_backends) / sizeof(inflate_backends[0]))
+
+// the backend by name or NULL if it is not built in. "auto" is the fastest
+// one which inflates by parts, so that memory doesn't grow with the image:
+// libdeflate is quicker but needs the whole image inflated at once, so it is
+// taken only if it is the only one built in or asked for by name
+static inline const struct inflate_backend* inflate_find(const char* name)
+{
+	if (strcmp(name, "auto") == 0)
+	{
+		for (size_t i = 0; i < INFLATE_BACKEND_COUNT; i++)
+		{
+			if (inflate_backends[i].stream != NULL)
+			{
+				return &inflate_backends[i];
+			}
+		}
+		return &inflate_backends[0];
+	}
+	for (size_t i = 0; i < INFLATE_BACKEND_COUNT; i++)
+	{
+		if (strcmp(name, inflate_backends[i].name) == 0)
+		{
+			return &inflate_backends[i];
+		}
+	}
+	return NULL;
+}
+
+static inline int inflate_open(struct inflater* inf, const struct inflate_backend* backend)
+{
+	memset(inf, 0, sizeof(*inf));
+	inf->backend = backend;
+	return backend->open(inf);
+}
+
+static inline void inflate_close(struct inflater* inf)
+{
+	inf->backend->close(inf);
+}
+
+#endif
@@ -1,39 +1,38 @@
 #define _CRT_SECURE_NO_WARNINGS
+#if defined(__unix__) || defined(__APPLE__)
+	// the output is mapped or written with writev there
+	#define PPM_POSIX
+	#define _POSIX_C_SOURCE 200809L
+#endif
+#include "pack.h"
 #include "return_codes.h"
+#include "unfilter.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#ifdef PPM_POSIX
+	#include <errno.h>
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <sys/uio.h>
+	#include <unistd.h>
+#endif
 
-#define LIBDEFLATE
+// the inflate backends built in, any set of them; --inflate auto takes the
+// fastest one which inflates by parts (see inflate_find). zlib is the
+// default as it does, so memory doesn't grow with the image; libdeflate can't
+#define ZLIB
 
 //#define ISAL
 
-//#define ZLIB
-
-#ifdef ZLIB
-
-	#include <zlib.h>
-
-#elif defined(LIBDEFLATE)
-
-	#include <libdeflate.h>
-
-#elif defined(ISAL)
-
-	#include <include/igzip_lib.h>
-
-#else
-	#error wrong macros
-#endif
+//#define LIBDEFLATE
 
-// int has_IEND = 0;
+#include "inflate.h"
 
-void read_bytes(unsigned char* from, unsigned char* to, int len, long st)
-{
-	for (int i = 0; i < len; i++)
-	{
-		to[i] = from[st + i];
-	}
-}
+// IDAT payloads are read and inflated by pieces of this size
+#define CHUNK_PIECE_SIZE 65536
 
 int is_png(unsigned char* magic, long size)
 {
@@ -65,361 +64,835 @@ int is_smth(unsigned char* type, unsigned char* comp)
 	return 1;
 }
 
+int is_IHDR(unsigned char* type)
+{
+	unsigned char IHDR[4] = { 'I', 'H', 'D', 'R' };
+	return is_smth(type, IHDR);
+}
+
 int is_IDAT(unsigned char* type)
 {
 	unsigned char IDAT[4] = { 'I', 'D', 'A', 'T' };
 	return is_smth(type, IDAT);
 }
 
+int is_PLTE(unsigned char* type)
+{
+	unsigned char PLTE[4] = { 'P', 'L', 'T', 'E' };
+	return is_smth(type, PLTE);
+}
+
 int is_IEND(unsigned char* type)
 {
 	unsigned char IEND[4] = { 'I', 'E', 'N', 'D' };
 	return is_smth(type, IEND);
 }
 
-int is_my_IEND(unsigned char* type)
+unsigned long get_number(unsigned char* arr)
 {
-	unsigned char iend[4] = { 'i', 'e', 'n', 'd' };
-	return is_smth(type, iend);
+	unsigned long number = 0;
+	for (int i = 0; i < 4; i++)
+	{
+		number = number * 256 + arr[i];
+	}
+
+	return number;
 }
 
-int get_number(unsigned char* arr)
+int read_exact(FILE* input, unsigned char* to, size_t len)
 {
-	const int power[4] = { 1, 256, 65536, 16777216 };
-	int number = 0;
-	for (int i = 0; i < 4; i++)
+	return fread(to, 1, len, input) == len;
+}
+
+// bit depths the png spec allows for a color type
+int is_supported(int type_color, int depth)
+{
+	switch (type_color)
 	{
-		number += power[3 - i] * arr[i];
+	case 0:
+		return depth == 1 || depth == 2 || depth == 4 || depth == 8 || depth == 16;
+	case 3:
+		return depth == 1 || depth == 2 || depth == 4 || depth == 8;
+	case 2:
+	case 4:
+	case 6:
+		return depth == 8 || depth == 16;
+	default:
+		return 0;
 	}
+}
 
-	return number;
+// the passes of an image: first column and row, steps between columns and
+// rows; Adam7 for interlaced images
+const int adam7[7][4] = { { 0, 0, 8, 8 }, { 4, 0, 8, 8 }, { 0, 4, 4, 8 }, { 2, 0, 4, 4 },
+						  { 0, 2, 2, 4 }, { 1, 0, 2, 2 }, { 0, 1, 1, 2 } };
+const int one_pass[1][4] = { { 0, 0, 1, 1 } };
+
+struct converter
+{
+	unsigned long width;
+	unsigned long height;
+	int type_color;
+	int depth;
+	// png samples per pixel
+	int channels;
+	// ppm samples per pixel, 1 or 3, and bytes per sample, 1 or 2
+	int out_channels;
+	int out_sample;
+	size_t out_stride;
+
+	// pass_width, pass_height and row_size (bytes of a row with its filter
+	// byte) are of the current pass, done counts its rows; the image is
+	// complete when pass is passes
+	const int (*geometry)[4];
+	int passes;
+	int pass;
+	unsigned long pass_width;
+	unsigned long pass_height;
+	size_t row_size;
+
+	// the filter byte of the row being inflated goes to filter and its pixels
+	// right to their place in the mapped output if they need no packing
+	// (in_place), otherwise to a window of two rows: the current one and the
+	// previous one
+	unsigned char filter;
+	int in_place;
+	unsigned char* rows[2];
+	unsigned char* zero;
+	size_t filled;
+	unsigned long done;
+
+	// by filter type
+	unfilter_fn kernels[5];
+
+	// pack is NULL if png rows are ppm rows already; a packed row goes to
+	// line if it has no place in the output to go right to
+	pack_fn pack;
+	scatter_fn scatter;
+	unsigned char* line;
+	int palette_size;
+	unsigned char lut[PACK_LUT_SIZE];
+
+	FILE* output;
+	unsigned char* map;
+	size_t map_size;
+	size_t header_size;
+	// the whole output of an interlaced image, if it is not mapped
+	unsigned char* image;
+
+	struct inflater* inf;
+	int finished;
+	// backends without a streaming interface get the compressed data kept
+	// until IEND and inflate it into the whole image at once
+	unsigned char* idat;
+	size_t idat_size;
+	size_t idat_capacity;
+};
+
+// bytes of a png row of width pixels without its filter byte
+size_t png_row_bytes(struct converter* conv, unsigned long width)
+{
+	return ((size_t)width * conv->channels * conv->depth + 7) / 8;
 }
 
-long get_IDAT_size(unsigned char* input_buffer, unsigned char* filling_buffer, int to_fill)
+void pass_size(struct converter* conv, int pass, unsigned long* width, unsigned long* height)
 {
-	long st = 33L;
-	long IDAT_size = 0L;
+	const int* g = conv->geometry[pass];
+	*width = conv->width > (unsigned long)g[0] ? (conv->width - g[0] + g[2] - 1) / g[2] : 0;
+	*height = conv->height > (unsigned long)g[1] ? (conv->height - g[1] + g[3] - 1) / g[3] : 0;
+}
 
-	unsigned char* buff = 0;
-	do
+// the first pass with any pixels from pass on, passes if there is none
+void start_pass(struct converter* conv, int pass)
+{
+	for (; pass < conv->passes; pass++)
 	{
-		buff = (unsigned char*)malloc(4 * sizeof(unsigned char));
-		if (NULL == buff)
+		pass_size(conv, pass, &conv->pass_width, &conv->pass_height);
+		if (conv->pass_width > 0 && conv->pass_height > 0)
 		{
-			fprintf(stderr, "can't allocate memory\n");
-			return -1;
+			break;
 		}
-		read_bytes(input_buffer, buff, 4, st);
-		int len = get_number(buff);
-		read_bytes(input_buffer, buff, 4, st + 4);
+	}
+	conv->pass = pass;
+	conv->done = 0;
+	conv->row_size = png_row_bytes(conv, conv->pass_width) + 1;
+}
 
-		if (is_IDAT(buff))
+void next_row(struct converter* conv)
+{
+	conv->done++;
+	if (conv->done == conv->pass_height)
+	{
+		start_pass(conv, conv->pass + 1);
+	}
+}
+
+// bytes of the inflated image, the rows of all the passes with their filter
+// bytes; 0 if it doesn't fit in memory
+size_t inflated_size(struct converter* conv)
+{
+	size_t total = 0;
+	for (int pass = 0; pass < conv->passes; pass++)
+	{
+		unsigned long width;
+		unsigned long height;
+		pass_size(conv, pass, &width, &height);
+		if (width == 0 || height == 0)
 		{
-			if (to_fill)
-			{
-				for (int i = 0; i < len; i++)
-				{
-					filling_buffer[IDAT_size + i] = input_buffer[st + 8 + i];
-				}
-			}
-			IDAT_size += len;
+			continue;
+		}
+		size_t row = png_row_bytes(conv, width) + 1;
+		if (height > ((size_t)-1 - total) / row)
+		{
+			return 0;
 		}
+		total += row * height;
+	}
+	return total;
+}
 
-		st += len + 12;
+unsigned char* row_pixels(struct converter* conv, unsigned long y)
+{
+	if (conv->in_place)
+	{
+		return conv->map + conv->header_size + y * conv->out_stride;
+	}
+	return conv->rows[y & 1];
+}
 
-	} while (!is_IEND(buff) && !is_my_IEND(buff));
+// the place of output row y: in the mapping, or in the whole image kept for
+// an interlaced one; NULL if the row is written out at once
+unsigned char* output_row(struct converter* conv, unsigned long y)
+{
+	if (conv->map != NULL)
+	{
+		return conv->map + conv->header_size + y * conv->out_stride;
+	}
+	if (conv->image != NULL)
+	{
+		return conv->image + y * conv->out_stride;
+	}
+	return NULL;
+}
 
-	if (is_my_IEND(buff))
+int unfilter_row(struct converter* conv, int filter_type, unsigned char* pixels, const unsigned char* prev)
+{
+	if (filter_type > 4)
 	{
-		return -2;
+		fprintf(stderr, "The data in png was waste or wrong parsed\n");
+		return ERROR_INVALID_DATA;
 	}
+	conv->kernels[filter_type](pixels, prev, conv->row_size - 1);
+	return 0;
+}
 
-	free(buff);
-	return IDAT_size;
+int write_rows(struct converter* conv, const unsigned char* pixels, unsigned long count, size_t step)
+{
+	for (unsigned long i = 0; i < count; i++)
+	{
+		if (fwrite(pixels + i * step, 1, conv->out_stride, conv->output) != conv->out_stride)
+		{
+			fprintf(stderr, "can't write output file\n");
+			return ERROR_UNKNOWN;
+		}
+	}
+	return 0;
 }
 
-int abss(int x, int y)
+// an unfiltered row of the current pass is packed to ppm pixels and put in
+// its place in the output, spread over an output row for a pass of an
+// interlaced image; it is written out at once if it has no place
+int emit_row(struct converter* conv, const unsigned char* pixels)
 {
-	return (x > y) ? x - y : y - x;
+	const int* g = conv->geometry[conv->pass];
+	unsigned char* dest = output_row(conv, g[1] + conv->done * g[3]);
+	if (conv->passes == 1)
+	{
+		unsigned char* packed = dest != NULL ? dest : conv->line;
+		if (conv->pack != NULL)
+		{
+			conv->pack(packed, pixels, conv->width, conv->lut);
+			pixels = packed;
+		}
+		else if (dest != NULL && dest != pixels)
+		{
+			memcpy(dest, pixels, conv->out_stride);
+		}
+		return dest != NULL ? 0 : write_rows(conv, pixels, 1, 0);
+	}
+
+	if (conv->pack != NULL)
+	{
+		conv->pack(conv->line, pixels, conv->pass_width, conv->lut);
+		pixels = conv->line;
+	}
+	conv->scatter(dest + (size_t)g[0] * conv->out_channels * conv->out_sample, pixels, conv->pass_width, g[2]);
+	return 0;
+}
+
+// a full row is unfiltered and goes to the output
+int take_window_row(struct converter* conv)
+{
+	if (conv->filled < conv->row_size)
+	{
+		return 0;
+	}
+	conv->filled = 0;
+
+	unsigned long y = conv->done;
+	unsigned char* pixels = row_pixels(conv, y);
+	int code = unfilter_row(conv, conv->filter, pixels, y == 0 ? conv->zero : row_pixels(conv, y - 1));
+	if (code == 0)
+	{
+		code = emit_row(conv, pixels);
+	}
+	next_row(conv);
+	return code;
 }
 
-void fill_line(unsigned char* buffer, int filter_type, long ind, int width, int type_color)
+// the output file is mapped if it is a regular file which can be given its
+// whole size up front, then the rows are inflated and unfiltered right in
+// it; otherwise it is written by rows through stdio
+int open_output(struct converter* conv, const char* path)
 {
-	int bytes = type_color == 0 ? 1 : 3;
+	char header[64];
+	conv->header_size = (size_t)sprintf(header, "P%c\n%lu %lu\n%d\n", conv->out_channels == 1 ? '5' : '6', conv->width,
+										conv->height, conv->out_sample == 1 ? 255 : 65535);
 
-	for (int i = 1; i <= width; i++)
+#ifdef PPM_POSIX
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0)
 	{
-		int bpp = i > bytes ? buffer[ind * (width + 1) + i - bytes] : 0;
-		int upper = ind > 0 ? buffer[(ind - 1) * (width + 1) + i] : 0;
-		int bpp_upper = i > bytes && ind > 0 ? buffer[(ind - 1) * (width + 1) + i - bytes] : 0;
+		fprintf(stderr, "file already exists\n");
+		return ERROR_ALREADY_EXISTS;
+	}
 
-		if (filter_type == 0)
-		{
-			continue;
-		}
-		else if (filter_type == 1)
+	size_t stride = conv->out_stride;
+	struct stat info;
+	if (stride <= ((size_t)-1 - conv->header_size) / conv->height && (off_t)(conv->header_size + stride * conv->height) > 0 &&
+		fstat(fd, &info) == 0 && S_ISREG(info.st_mode))
+	{
+		size_t size = conv->header_size + stride * conv->height;
+		// with the blocks allocated a full disk can't fault in the middle
+		if (posix_fallocate(fd, 0, (off_t)size) == 0)
 		{
-			buffer[ind * (width + 1) + i] += bpp;
+			void* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if (map != MAP_FAILED)
+			{
+				close(fd);
+				conv->map = (unsigned char*)map;
+				conv->map_size = size;
+				memcpy(conv->map, header, conv->header_size);
+				return 0;
+			}
 		}
-		else if (filter_type == 2)
+	}
+	close(fd);
+#endif
+
+	conv->output = fopen(path, "wb");
+	if (NULL == conv->output)
+	{
+		fprintf(stderr, "file already exists\n");
+		return ERROR_ALREADY_EXISTS;
+	}
+	if (fwrite(header, 1, conv->header_size, conv->output) != conv->header_size)
+	{
+		fprintf(stderr, "can't write output file\n");
+		return ERROR_UNKNOWN;
+	}
+	return 0;
+}
+
+int close_output(struct converter* conv, int code)
+{
+#ifdef PPM_POSIX
+	if (conv->map != NULL)
+	{
+		if (munmap(conv->map, conv->map_size) != 0 && code == 0)
 		{
-			buffer[ind * (width + 1) + i] += upper;
+			fprintf(stderr, "can't write output file\n");
+			code = ERROR_UNKNOWN;
 		}
-		else if (filter_type == 3)
+		return code;
+	}
+#endif
+	if (conv->output != NULL && fclose(conv->output) != 0 && code == 0)
+	{
+		fprintf(stderr, "can't write output file\n");
+		code = ERROR_UNKNOWN;
+	}
+	return code;
+}
+
+// rows of an inflated and unfiltered image which are ppm rows already, each
+// behind its filter byte, to the output which is not mapped: handed to
+// writev a batch at a time so that the filter bytes are skipped without
+// copying
+int write_image(struct converter* conv, unsigned char* image)
+{
+	size_t stride = conv->out_stride;
+#ifdef PPM_POSIX
+	if (fflush(conv->output) != 0)
+	{
+		fprintf(stderr, "can't write output file\n");
+		return ERROR_UNKNOWN;
+	}
+
+	// the least IOV_MAX posix allows
+	struct iovec batch[16];
+	int fd = fileno(conv->output);
+	for (unsigned long y = 0; y < conv->height;)
+	{
+		int count = 0;
+		for (; count < 16 && y < conv->height; count++, y++)
 		{
-			buffer[ind * (width + 1) + i] += (bpp + upper) / 2;
+			batch[count].iov_base = image + y * conv->row_size + 1;
+			batch[count].iov_len = stride;
 		}
-		else if (filter_type == 4)
+
+		struct iovec* curr = batch;
+		while (count > 0)
 		{
-			int p = bpp + upper - bpp_upper;
-			int pa = abss(p, bpp);
-			int pb = abss(p, upper);
-			int pc = abss(p, bpp_upper);
-			if (pa <= pb && pa <= pc)
+			ssize_t written = writev(fd, curr, count);
+			if (written < 0 && errno == EINTR)
 			{
-				p = bpp;
+				continue;
 			}
-			else if (pb <= pc)
+			if (written <= 0)
 			{
-				p = upper;
+				fprintf(stderr, "can't write output file\n");
+				return ERROR_UNKNOWN;
 			}
-			else
+			while (count > 0 && (size_t)written >= curr->iov_len)
 			{
-				p = bpp_upper;
+				written -= (ssize_t)curr->iov_len;
+				curr++;
+				count--;
+			}
+			if (count > 0)
+			{
+				curr->iov_base = (unsigned char*)curr->iov_base + written;
+				curr->iov_len -= (size_t)written;
 			}
-			buffer[ind * (width + 1) + i] += p;
-		}
-		else
-		{
-			fprintf(stderr, "The data in png was waste or wrong parsed\n");
 		}
 	}
+	return 0;
+#else
+	return write_rows(conv, image + 1, conv->height, conv->row_size);
+#endif
 }
 
-void put_num(int x, FILE* fo)
+// where the inflated bytes go: the filter byte, the rest of the current row,
+// or a scratch byte once the image is complete, so that extra data shows up
+unsigned char* window_out(struct converter* conv, unsigned char* scratch, size_t* avail)
 {
-	unsigned char a[8];
-
-	int cnt = 0;
-	while (x > 0)
+	if (conv->pass == conv->passes)
+	{
+		*avail = 1;
+		return scratch;
+	}
+	if (conv->filled == 0)
 	{
-		a[cnt++] = (x % 10 + '0');
-		x /= 10;
+		*avail = 1;
+		return &conv->filter;
 	}
-	for (int i = cnt - 1; i >= 0; i--)
+	// the inflaters count in 32 bits
+	*avail = conv->row_size - conv->filled;
+	if (*avail > 0x40000000)
 	{
-		putc(a[i], fo);
+		*avail = 0x40000000;
 	}
+	return row_pixels(conv, conv->done) + conv->filled - 1;
 }
 
-int main(int argc, char* argv[])
+// left is what the inflater didn't fill of the avail bytes window_out gave
+// it; more data than the image holds is an error
+int window_advance(struct converter* conv, size_t avail, size_t left)
 {
-	if (argc != 3)
+	if (conv->pass == conv->passes)
 	{
-		fprintf(stderr, "expected: <pic1>.png <pic2>.ppm");
-		return ERROR_INVALID_PARAMETER;
+		if (left == 0)
+		{
+			fprintf(stderr, "bad data...\n");
+			return ERROR_INVALID_DATA;
+		}
+		return 0;
 	}
+	conv->filled += avail - left;
+	return take_window_row(conv);
+}
 
-	FILE* input_img = fopen(argv[1], "rb");
-	if (input_img == NULL)
+// the inflater may hold output back when the row is full, so it is called
+// again until it has neither input nor output left
+int inflater_feed(struct converter* conv, const unsigned char* in, size_t len)
+{
+	struct inflater* inf = conv->inf;
+	if (inf->backend->stream != NULL)
 	{
-		fprintf(stderr, "file %s didn't exists", argv[1]);
-		fclose(input_img);
-		return ERROR_FILE_EXISTS;
+		unsigned char scratch;
+		int more = 1;
+		while (more && !conv->finished)
+		{
+			size_t avail;
+			unsigned char* out = window_out(conv, &scratch, &avail);
+			size_t left = avail;
+			int res = inf->backend->stream(inf, &in, &len, &out, &left);
+			if (res == INFLATE_NO_MEMORY)
+			{
+				fprintf(stderr, "not enough memory\n");
+				return ERROR_NOT_ENOUGH_MEMORY;
+			}
+			else if (res == INFLATE_BAD_DATA)
+			{
+				fprintf(stderr, "bad data...\n");
+				return ERROR_INVALID_DATA;
+			}
+			conv->finished = res == INFLATE_END;
+
+			more = len > 0 || left == 0;
+			int code = window_advance(conv, avail, left);
+			if (code != 0)
+			{
+				return code;
+			}
+		}
+		return 0;
 	}
 
-	// getting the size of file
+	if (conv->idat_size + len > conv->idat_capacity)
+	{
+		size_t capacity = conv->idat_capacity == 0 ? CHUNK_PIECE_SIZE : conv->idat_capacity;
+		while (conv->idat_size + len > capacity)
+		{
+			capacity *= 2;
+		}
+		unsigned char* idat = (unsigned char*)realloc(conv->idat, capacity);
+		if (idat == NULL)
+		{
+			fprintf(stderr, "not enough memory\n");
+			return ERROR_NOT_ENOUGH_MEMORY;
+		}
+		conv->idat = idat;
+		conv->idat_capacity = capacity;
+	}
+	memcpy(conv->idat + conv->idat_size, in, len);
+	conv->idat_size += len;
+	return 0;
+}
 
-	fseek(input_img, 0, SEEK_END);
-	long input_size = ftell(input_img);
-	rewind(input_img);
+int inflater_finish(struct converter* conv)
+{
+	if (conv->inf->backend->stream != NULL)
+	{
+		if (conv->pass != conv->passes)
+		{
+			fprintf(stderr, "Something goes wrong, while uncompressing data, probably data is bad");
+			return ERROR_INVALID_DATA;
+		}
+		return 0;
+	}
 
-	unsigned char* input_buffer = (unsigned char*)malloc(sizeof(unsigned char) * input_size);
-	if (input_buffer == NULL)
+	size_t image_size = inflated_size(conv);
+	unsigned char* image = image_size == 0 ? NULL : (unsigned char*)malloc(image_size);
+	if (image == NULL)
 	{
 		fprintf(stderr, "not enough memory\n");
-		fclose(input_img);
 		return ERROR_NOT_ENOUGH_MEMORY;
 	}
 
-	long result = fread(input_buffer, 1, input_size, input_img);
-
-	for (int i = 0; i < 4; i++)
+	int res = conv->inf->backend->whole(conv->inf, conv->idat, conv->idat_size, image, image_size);
+	free(conv->idat);
+	conv->idat = NULL;
+	if (res != INFLATE_OK)
 	{
-		input_buffer[input_size + i] = '.';
+		fprintf(stderr, res == INFLATE_NO_MEMORY ? "not enough memory\n" : "bad data...\n");
+		free(image);
+		return res == INFLATE_NO_MEMORY ? ERROR_NOT_ENOUGH_MEMORY : ERROR_INVALID_DATA;
 	}
-	
-	input_buffer[input_size + 4] = 'i';
-	input_buffer[input_size + 5] = 'e';
-	input_buffer[input_size + 6] = 'n';
-	input_buffer[input_size + 7] = 'd';
 
-	if (result != input_size)
+	// rows which are ppm rows already go to writev all at once
+	int whole_rows = conv->passes == 1 && conv->pack == NULL && conv->map == NULL;
+	int code = 0;
+	unsigned char* row = image;
+	while (code == 0 && conv->pass < conv->passes)
 	{
-		fprintf(stderr, "can't read file");
-		fclose(input_img);
-		free(input_buffer);
-		return ERROR_UNKNOWN;
+		code = unfilter_row(conv, row[0], row + 1, conv->done == 0 ? conv->zero : row + 1 - conv->row_size);
+		if (code == 0 && !whole_rows)
+		{
+			code = emit_row(conv, row + 1);
+		}
+		row += conv->row_size;
+		next_row(conv);
 	}
-	fclose(input_img);
-
-	if (!is_png(input_buffer, input_size))
+	if (code == 0 && whole_rows)
 	{
-		fprintf(stderr, "%s is not png!", argv[1]);
-		free(input_buffer);
-		return ERROR_INVALID_DATA;
+		code = write_image(conv, image);
 	}
+	free(image);
+	return code;
+}
 
-	// HEADER PARSING
-
-	unsigned char len[4];
-	read_bytes(input_buffer, len, 4, 16);
-	int width = get_number(len);
-	read_bytes(input_buffer, len, 4, 20);
-	int height = get_number(len);
-	read_bytes(input_buffer, len, 1, 25);
-	int type_color = len[0];
-
-	if (type_color != 0 && type_color != 2)
+// the palette of an indexed image goes right to the table of its kernel
+int take_palette(struct converter* conv, const unsigned char* palette, size_t len)
+{
+	if (len == 0 || len > 256 * 3 || len % 3 != 0)
 	{
-		fprintf(stderr, "type color of %s is wrong(expected to grayscale(0) or RGB(2)), but get = %d\n", argv[1], type_color);
-		free(input_buffer);
+		fprintf(stderr, "bad PLTE chunk\n");
 		return ERROR_INVALID_DATA;
 	}
+	if (conv->type_color == 3)
+	{
+		conv->palette_size = (int)(len / 3);
+		pack_fill_lut(conv->lut, conv->depth, 3, palette, conv->palette_size);
+	}
+	return 0;
+}
 
-	// ========================
+// reads the chunks one by one, so only a piece of IDAT and two rows of the
+// image are in memory at once (and the whole output of an interlaced image
+// written through stdio)
+int convert(FILE* input, struct converter* conv)
+{
+	unsigned char* piece = (unsigned char*)malloc(CHUNK_PIECE_SIZE);
+	if (piece == NULL)
+	{
+		fprintf(stderr, "not enough memory\n");
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
 
-	long IDAT_arr_size = get_IDAT_size(input_buffer, 0, 0);
-	if (IDAT_arr_size < 0)
+	int code = 0;
+	unsigned char head[8];
+	while (code == 0)
 	{
-		if (IDAT_arr_size == -1)
+		if (!read_exact(input, head, 8))
 		{
-			fprintf(stderr, "Something goes wrong, while parsing IDAT(most likely memory error)\n");
+			fprintf(stderr, "no IEND chunk");
+			code = ERROR_INVALID_DATA;
+			break;
 		}
-		else if (IDAT_arr_size == -2)
+		unsigned long len = get_number(head);
+		if (is_IDAT(head + 4) && conv->type_color == 3 && conv->palette_size == 0)
 		{
-			fprintf(stderr, "no IEND chunk");
+			fprintf(stderr, "no PLTE chunk before IDAT\n");
+			code = ERROR_INVALID_DATA;
+			break;
+		}
+		if (is_IEND(head + 4))
+		{
+			code = inflater_finish(conv);
+			break;
+		}
+
+		while (len > 0 && code == 0)
+		{
+			size_t part = len < CHUNK_PIECE_SIZE ? len : CHUNK_PIECE_SIZE;
+			if (!read_exact(input, piece, part))
+			{
+				fprintf(stderr, "unexpected end of file\n");
+				code = ERROR_INVALID_DATA;
+			}
+			else if (is_IDAT(head + 4))
+			{
+				code = inflater_feed(conv, piece, part);
+			}
+			else if (is_PLTE(head + 4))
+			{
+				// a right chunk fits in a piece, a longer one is rejected by its length
+				code = take_palette(conv, piece, len);
+			}
+			len -= part;
+		}
+
+		// crc
+		if (code == 0 && !read_exact(input, head, 4))
+		{
+			fprintf(stderr, "unexpected end of file\n");
+			code = ERROR_INVALID_DATA;
 		}
-		free(input_buffer);
-		return ERROR_UNKNOWN;
 	}
-	unsigned char* IDAT_source = (unsigned char*)malloc(IDAT_arr_size * sizeof(unsigned char));
-	IDAT_arr_size = get_IDAT_size(input_buffer, IDAT_source, 1);
-	if (IDAT_arr_size == -1)
+
+	free(piece);
+	return code;
+}
+
+// eight_bit cuts 16-bit samples to 8 bits
+int convert_file(struct inflater* inf, const char* input_path, const char* output_path, int eight_bit)
+{
+	FILE* input_img = fopen(input_path, "rb");
+	if (input_img == NULL)
 	{
-		fprintf(stderr, "Something goes wrong, while parsing IDAT(most likely memory error)\n");
-		free(input_buffer);
-		free(IDAT_source);
-		return ERROR_UNKNOWN;
+		fprintf(stderr, "file %s didn't exists", input_path);
+		return ERROR_FILE_EXISTS;
 	}
 
-	long available_size = (long)width * height * 4;
-	unsigned char* buffer = (unsigned char*)malloc(available_size * sizeof(unsigned char));
-
-#ifdef ZLIB
-	uLong available_size_zlib = available_size;
-	int res = uncompress(buffer, &available_size_zlib, IDAT_source, IDAT_arr_size);
+	// HEADER PARSING
 
-	if (res == Z_MEM_ERROR)
+	unsigned char header[33];
+	if (!read_exact(input_img, header, 8) || !is_png(header, 8))
 	{
-		fprintf(stderr, "not enough memory\n");
-		free(IDAT_source);
-		free(buffer);
-		return ERROR_NOT_ENOUGH_MEMORY;
+		fprintf(stderr, "%s is not png!", input_path);
+		fclose(input_img);
+		return ERROR_INVALID_DATA;
 	}
-	else if (res == Z_DATA_ERROR)
+	if (!read_exact(input_img, header + 8, 25) || get_number(header + 8) != 13 || !is_IHDR(header + 12))
 	{
-		fprintf(stderr, "bad data...\n");
-		free(IDAT_source);
-		free(buffer);
+		fprintf(stderr, "%s has no IHDR chunk\n", input_path);
+		fclose(input_img);
 		return ERROR_INVALID_DATA;
 	}
 
-#endif
+	struct converter conv;
+	memset(&conv, 0, sizeof(conv));
+	conv.width = get_number(header + 16);
+	conv.height = get_number(header + 20);
+	conv.depth = header[24];
+	conv.type_color = header[25];
+	int interlace = header[28];
 
-#ifdef LIBDEFLATE
-	size_t p = (size_t)width * height * 6;
-	int res = libdeflate_zlib_decompress(libdeflate_alloc_decompressor(), IDAT_source, IDAT_arr_size, buffer, available_size, &p);
-	if (res == LIBDEFLATE_BAD_DATA)
+	if (!is_supported(conv.type_color, conv.depth))
 	{
-		fprintf(stderr, "bad data...\n");
-		free(IDAT_source);
-		free(buffer);
+		fprintf(stderr, "%s: color type %d with bit depth %d is not allowed by png\n", input_path, conv.type_color, conv.depth);
+		fclose(input_img);
 		return ERROR_INVALID_DATA;
 	}
-	else if (res == LIBDEFLATE_INSUFFICIENT_SPACE)
+	if (header[26] != 0 || header[27] != 0 || interlace > 1 || conv.width == 0 || conv.height == 0 ||
+		conv.width > 0x7fffffffUL || conv.height > 0x7fffffffUL)
 	{
-		fprintf(stderr, "not enough memory\n");
-		free(IDAT_source);
-		free(buffer);
-		return ERROR_NOT_ENOUGH_MEMORY;
+		fprintf(stderr, "%s: wrong size or unknown compression, filter or interlace method\n", input_path);
+		fclose(input_img);
+		return ERROR_INVALID_DATA;
 	}
-#endif
 
-#ifdef ISAL
-	struct inflate_state uncompress;
-	isal_inflate_init(&uncompress);
-	uncompress.next_in = IDAT_source;
-	uncompress.avail_in = IDAT_arr_size;
-	uncompress.next_out = buffer;
-	uncompress.avail_out = available_size;
-	uncompress.crc_flag = IGZIP_ZLIB;
-	int res = isal_inflate(&uncompress);
+	// ========================
 
-	if (res == ISAL_OUT_OVERFLOW)
+	const int channels[7] = { 1, 0, 3, 1, 2, 0, 4 };
+	conv.channels = channels[conv.type_color];
+	conv.out_channels = conv.type_color == 0 || conv.type_color == 4 ? 1 : 3;
+	conv.out_sample = conv.depth == 16 && !eight_bit ? 2 : 1;
+	conv.out_stride = (size_t)conv.width * conv.out_channels * conv.out_sample;
+	conv.geometry = interlace ? adam7 : one_pass;
+	conv.passes = interlace ? 7 : 1;
+	start_pass(&conv, 0);
+
+	// a pixel of less than a byte is unfiltered as a byte
+	int bpp = conv.channels * conv.depth / 8;
+	unfilter_choose(bpp > 0 ? bpp : 1, 1, conv.kernels);
+	conv.pack = pack_choose(conv.type_color, conv.depth, conv.out_sample * 8);
+	conv.scatter = pack_choose_scatter(conv.out_channels * conv.out_sample);
+	if (conv.type_color == 0 && conv.depth < 8)
 	{
-		fprintf(stderr, "not enough memory\n");
-		free(IDAT_source);
-		free(buffer);
-		return ERROR_NOT_ENOUGH_MEMORY;
+		pack_fill_gray_lut(conv.lut, conv.depth);
 	}
 
-#endif
+	conv.inf = inf;
+	inf->backend->reset(inf);
 
-	free(IDAT_source);
-
-	if (res == 0)
+	int code = open_output(&conv, output_path);
+	if (code == 0)
 	{
-		FILE* output_image = fopen(argv[2], "wb");
-		if (NULL == output_image)
+		size_t png_stride = png_row_bytes(&conv, conv.width);
+		conv.in_place = conv.passes == 1 && conv.pack == NULL && conv.map != NULL;
+		conv.zero = (unsigned char*)calloc(png_stride, 1);
+		if (!conv.in_place)
+		{
+			conv.rows[0] = (unsigned char*)malloc(png_stride);
+			conv.rows[1] = (unsigned char*)malloc(png_stride);
+		}
+		if (conv.pack != NULL)
+		{
+			conv.line = (unsigned char*)malloc(conv.out_stride);
+		}
+		if (conv.passes > 1 && conv.map == NULL && conv.out_stride <= (size_t)-1 / conv.height)
+		{
+			conv.image = (unsigned char*)malloc(conv.out_stride * conv.height);
+		}
+		if (conv.zero == NULL || (!conv.in_place && (conv.rows[0] == NULL || conv.rows[1] == NULL)) ||
+			(conv.pack != NULL && conv.line == NULL) || (conv.passes > 1 && conv.map == NULL && conv.image == NULL))
+		{
+			fprintf(stderr, "not enough memory\n");
+			code = ERROR_NOT_ENOUGH_MEMORY;
+		}
+		else
 		{
-			fprintf(stderr, "file already exists\n");
-			free(buffer);
-			return ERROR_ALREADY_EXISTS;
+			code = convert(input_img, &conv);
 		}
+		if (code == 0 && conv.image != NULL)
+		{
+			code = write_rows(&conv, conv.image, conv.height, conv.out_stride);
+		}
+	}
+	code = close_output(&conv, code);
+	if (code != 0 && code != ERROR_ALREADY_EXISTS)
+	{
+		remove(output_path);
+	}
 
-		putc('P', output_image);
-		char v = (type_color == 0) ? '5' : '6';
-		putc(v, output_image);
-		putc('\n', output_image);
-		put_num(width, output_image);
-		putc(' ', output_image);
-		put_num(height, output_image);
-		putc('\n', output_image);
-		put_num(255, output_image);
-		putc('\n', output_image);
+	free(conv.idat);
+	free(conv.rows[0]);
+	free(conv.rows[1]);
+	free(conv.zero);
+	free(conv.line);
+	free(conv.image);
+	fclose(input_img);
+	return code;
+}
 
-		width *= (type_color == 0) ? 1 : 3;
-		for (int i = 0; i < height; i++)
+int main(int argc, char* argv[])
+{
+	const char* backend_name = "auto";
+	int eight_bit = 0;
+	int first = 1;
+	for (; first < argc; first++)
+	{
+		if (strcmp(argv[first], "--inflate") == 0 && first + 1 < argc)
+		{
+			backend_name = argv[++first];
+		}
+		else if (strcmp(argv[first], "--8bit") == 0)
+		{
+			eight_bit = 1;
+		}
+		else
 		{
-			int filter_type = buffer[i * (width + 1)];
-			fill_line(buffer, filter_type, (long)i, width, type_color);
+			break;
 		}
+	}
+	if (argc - first < 2 || (argc - first) % 2 != 0)
+	{
+		fprintf(stderr, "expected: [--inflate auto|<backend>] [--8bit] <pic1>.png <pic2>.ppm [<pic3>.png <pic4>.ppm ...]");
+		return ERROR_INVALID_PARAMETER;
+	}
 
-		for (int i = 0; i < height; i++)
+	const struct inflate_backend* backend = inflate_find(backend_name);
+	if (backend == NULL)
+	{
+		fprintf(stderr, "inflate backend %s is not built in, there are:", backend_name);
+		for (size_t i = 0; i < INFLATE_BACKEND_COUNT; i++)
 		{
-			for (int j = 1; j <= width; j++)
-			{
-				putc(buffer[(long)i * (width + 1) + j], output_image);
-			}
+			fprintf(stderr, " %s", inflate_backends[i].name);
 		}
-		fclose(output_image);
+		fprintf(stderr, "\n");
+		return ERROR_INVALID_PARAMETER;
 	}
-	else
+
+	struct inflater inf;
+	if (inflate_open(&inf, backend) != INFLATE_OK)
 	{
-		fprintf(stderr, "Something goes wrong, while uncompressing data, probably data is bad");
-		free(buffer);
-		return ERROR_UNKNOWN;
+		fprintf(stderr, "not enough memory\n");
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+
+	// one decompressor context for all the images, the first error is returned
+	int code = 0;
+	for (int i = first; i < argc; i += 2)
+	{
+		int res = convert_file(&inf, argv[i], argv[i + 1], eight_bit);
+		if (code == 0)
+		{
+			code = res;
+		}
 	}
-	free(buffer);
+	inflate_close(&inf);
+	return code;
 }
@@ -0,0 +1,155 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include <stddef.h>
+#include <string.h>
+
+// unfiltered png rows to ppm/pgm pixels: one kernel per color type and bit
+// depth, picked once per image, with the sizes as constants. Pixels of less
+// than a byte and palette indices go through a table from a whole input byte
+// to all the output bytes of its pixels; alpha is dropped and 16-bit samples
+// are either kept (ppm is big-endian as png is) or cut to their high byte
+
+// width is in pixels, lut is filled by pack_fill_lut for the expanding kernels
+typedef void (*pack_fn)(unsigned char* out, const unsigned char* in, size_t width, const unsigned char* lut);
+
+// the most output bytes of one input byte: 8 palette pixels of 3 bytes
+#define PACK_LUT_STEP 24
+#define PACK_LUT_SIZE (256 * PACK_LUT_STEP)
+
+// an input byte of per_byte pixels is step output bytes at lut + byte * step;
+// the last byte of a row may hold fewer pixels
+#define PACK_EXPAND_KERNEL(name, step, per_byte)                                                                 \
+	static void pack_##name(unsigned char* out, const unsigned char* in, size_t width, const unsigned char* lut) \
+	{                                                                                                            \
+		size_t full = width / per_byte;                                                                          \
+		for (size_t i = 0; i < full; i++)                                                                        \
+		{                                                                                                        \
+			memcpy(out + i * step, lut + in[i] * step, step);                                                    \
+		}                                                                                                        \
+		if (width % per_byte != 0)                                                                               \
+		{                                                                                                        \
+			memcpy(out + full * step, lut + in[full] * step, width % per_byte * (step / per_byte));              \
+		}                                                                                                        \
+	}
+
+PACK_EXPAND_KERNEL(gray_1, 8, 8)
+PACK_EXPAND_KERNEL(gray_2, 4, 4)
+PACK_EXPAND_KERNEL(gray_4, 2, 2)
+PACK_EXPAND_KERNEL(palette_1, 24, 8)
+PACK_EXPAND_KERNEL(palette_2, 12, 4)
+PACK_EXPAND_KERNEL(palette_4, 6, 2)
+PACK_EXPAND_KERNEL(palette_8, 3, 1)
+
+// of every in_bytes input pixel out_bytes output bytes are taken, every
+// skip-th byte: alpha is the last sample, the low byte of a 16-bit sample is
+// the second one
+#define PACK_PICK_KERNEL(name, in_bytes, out_bytes, skip)                                                        \
+	static void pack_##name(unsigned char* out, const unsigned char* in, size_t width, const unsigned char* lut) \
+	{                                                                                                            \
+		(void)lut;                                                                                               \
+		for (size_t i = 0; i < width; i++)                                                                       \
+		{                                                                                                        \
+			for (int j = 0; j < out_bytes; j++)                                                                  \
+			{                                                                                                    \
+				out[i * out_bytes + j] = in[i * in_bytes + j * skip];                                            \
+			}                                                                                                    \
+		}                                                                                                        \
+	}
+
+PACK_PICK_KERNEL(gray_alpha_8, 2, 1, 1)
+PACK_PICK_KERNEL(rgba_8, 4, 3, 1)
+PACK_PICK_KERNEL(gray_alpha_16, 4, 2, 1)
+PACK_PICK_KERNEL(rgba_16, 8, 6, 1)
+PACK_PICK_KERNEL(gray_16_to_8, 2, 1, 2)
+PACK_PICK_KERNEL(gray_alpha_16_to_8, 4, 1, 2)
+PACK_PICK_KERNEL(rgb_16_to_8, 6, 3, 2)
+PACK_PICK_KERNEL(rgba_16_to_8, 8, 3, 2)
+
+// the kernel for png pixels of type_color and depth to ppm ones of out_depth
+// (8, or 16 for 16-bit png), NULL if the rows are the same already
+static pack_fn pack_choose(int type_color, int depth, int out_depth)
+{
+	int cut = depth == 16 && out_depth == 8;
+	switch (type_color)
+	{
+	case 0:
+		if (depth < 8)
+		{
+			return depth == 1 ? pack_gray_1 : depth == 2 ? pack_gray_2 : pack_gray_4;
+		}
+		return cut ? pack_gray_16_to_8 : NULL;
+	case 2:
+		return cut ? pack_rgb_16_to_8 : NULL;
+	case 3:
+		return depth == 1 ? pack_palette_1 : depth == 2 ? pack_palette_2 : depth == 4 ? pack_palette_4 : pack_palette_8;
+	case 4:
+		return depth == 8 ? pack_gray_alpha_8 : cut ? pack_gray_alpha_16_to_8 : pack_gray_alpha_16;
+	default:
+		return depth == 8 ? pack_rgba_8 : cut ? pack_rgba_16_to_8 : pack_rgba_16;
+	}
+}
+
+// the table of the expanding kernels for pixels of depth bits: colors has
+// count entries of channels bytes, an index past them is black
+static void pack_fill_lut(unsigned char* lut, int depth, int channels, const unsigned char* colors, int count)
+{
+	int per_byte = 8 / depth;
+	int mask = (1 << depth) - 1;
+	size_t step = (size_t)per_byte * channels;
+	for (int byte = 0; byte < 256; byte++)
+	{
+		for (int i = 0; i < per_byte; i++)
+		{
+			// the first pixel is in the high bits
+			int index = byte >> (8 - depth * (i + 1)) & mask;
+			unsigned char* to = lut + byte * step + i * channels;
+			if (index < count)
+			{
+				memcpy(to, colors + index * channels, channels);
+			}
+			else
+			{
+				memset(to, 0, channels);
+			}
+		}
+	}
+}
+
+// gray levels of depth bits stretched to 0..255
+static void pack_fill_gray_lut(unsigned char* lut, int depth)
+{
+	unsigned char levels[16];
+	int mask = (1 << depth) - 1;
+	for (int i = 0; i <= mask; i++)
+	{
+		levels[i] = (unsigned char)(i * 255 / mask);
+	}
+	pack_fill_lut(lut, depth, 1, levels, mask + 1);
+}
+
+// count pixels of bytes each from in to every step-th pixel of out, for
+// the passes of interlaced images
+typedef void (*scatter_fn)(unsigned char* out, const unsigned char* in, size_t count, size_t step);
+
+#define PACK_SCATTER_KERNEL(bytes)                                                                           \
+	static void pack_scatter_##bytes(unsigned char* out, const unsigned char* in, size_t count, size_t step) \
+	{                                                                                                        \
+		for (size_t i = 0; i < count; i++)                                                                   \
+		{                                                                                                    \
+			memcpy(out + i * step * bytes, in + i * bytes, bytes);                                           \
+		}                                                                                                    \
+	}
+
+PACK_SCATTER_KERNEL(1)
+PACK_SCATTER_KERNEL(2)
+PACK_SCATTER_KERNEL(3)
+PACK_SCATTER_KERNEL(6)
+
+// bytes of an output pixel: 1, 2, 3 or 6
+static scatter_fn pack_choose_scatter(int bytes)
+{
+	return bytes == 1 ? pack_scatter_1 : bytes == 2 ? pack_scatter_2 : bytes == 3 ? pack_scatter_3 : pack_scatter_6;
+}
+
+#endif
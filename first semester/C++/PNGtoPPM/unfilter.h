@@ -0,0 +1,448 @@
+#ifndef UNFILTER_H
+#define UNFILTER_H
+
+#include <stddef.h>
+#include <string.h>
+
+// png scanline unfiltering: one kernel per filter type and bytes per pixel,
+// picked once per image. Sub, Average and Paeth depend on the pixel bpp bytes
+// back, so only Up is vectorized across the row; the others do a whole pixel
+// per step (or a prefix sum for Sub)
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define UNFILTER_SSE2
+	#include <emmintrin.h>
+#endif
+
+#if defined(UNFILTER_SSE2) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	#define UNFILTER_AVX2
+	#include <immintrin.h>
+#endif
+
+// row and prev point past the filter byte, prev is all zeros for the first row
+typedef void (*unfilter_fn)(unsigned char* row, const unsigned char* prev, size_t len);
+
+static void unfilter_none(unsigned char* row, const unsigned char* prev, size_t len)
+{
+	(void)row;
+	(void)prev;
+	(void)len;
+}
+
+// scalar kernels, bpp is a constant in every caller
+
+static inline void unfilter_sub_scalar(unsigned char* row, size_t from, size_t len, int bpp)
+{
+	for (size_t i = from < (size_t)bpp ? (size_t)bpp : from; i < len; i++)
+	{
+		row[i] += row[i - bpp];
+	}
+}
+
+static inline void unfilter_up_scalar(unsigned char* row, const unsigned char* prev, size_t from, size_t len)
+{
+	for (size_t i = from; i < len; i++)
+	{
+		row[i] += prev[i];
+	}
+}
+
+static inline void unfilter_avg_scalar(unsigned char* row, const unsigned char* prev, size_t from, size_t len, int bpp)
+{
+	size_t i = from;
+	for (; i < len && i < (size_t)bpp; i++)
+	{
+		row[i] += prev[i] >> 1;
+	}
+	for (; i < len; i++)
+	{
+		row[i] += (row[i - bpp] + prev[i]) >> 1;
+	}
+}
+
+static inline int unfilter_paeth_predict(int a, int b, int c)
+{
+	int pa = b - c;
+	int pb = a - c;
+	int pc = pa + pb;
+	pa = pa < 0 ? -pa : pa;
+	pb = pb < 0 ? -pb : pb;
+	pc = pc < 0 ? -pc : pc;
+	// selects instead of branches, the choice is random on noisy images
+	int p = pb <= pc ? b : c;
+	return (pa <= pb) & (pa <= pc) ? a : p;
+}
+
+static inline void unfilter_paeth_scalar(unsigned char* row, const unsigned char* prev, size_t from, size_t len, int bpp)
+{
+	size_t i = from;
+	// with no left neighbour the predictor is the upper byte
+	for (; i < len && i < (size_t)bpp; i++)
+	{
+		row[i] += prev[i];
+	}
+	for (; i < len; i++)
+	{
+		row[i] += unfilter_paeth_predict(row[i - bpp], prev[i], prev[i - bpp]);
+	}
+}
+
+#define UNFILTER_SCALAR_KERNELS(bpp)                                                                   \
+	static void unfilter_sub_##bpp(unsigned char* row, const unsigned char* prev, size_t len)           \
+	{                                                                                                  \
+		(void)prev;                                                                                    \
+		unfilter_sub_scalar(row, 0, len, bpp);                                                         \
+	}                                                                                                  \
+	static void unfilter_avg_##bpp(unsigned char* row, const unsigned char* prev, size_t len)           \
+	{                                                                                                  \
+		unfilter_avg_scalar(row, prev, 0, len, bpp);                                                   \
+	}                                                                                                  \
+	static void unfilter_paeth_##bpp(unsigned char* row, const unsigned char* prev, size_t len)         \
+	{                                                                                                  \
+		unfilter_paeth_scalar(row, prev, 0, len, bpp);                                                 \
+	}
+
+UNFILTER_SCALAR_KERNELS(1)
+UNFILTER_SCALAR_KERNELS(2)
+UNFILTER_SCALAR_KERNELS(3)
+UNFILTER_SCALAR_KERNELS(4)
+UNFILTER_SCALAR_KERNELS(6)
+UNFILTER_SCALAR_KERNELS(8)
+
+static void unfilter_up(unsigned char* row, const unsigned char* prev, size_t len)
+{
+	unfilter_up_scalar(row, prev, 0, len);
+}
+
+#ifdef UNFILTER_SSE2
+
+static void unfilter_up_sse2(unsigned char* row, const unsigned char* prev, size_t len)
+{
+	size_t i = 0;
+	for (; i + 16 <= len; i += 16)
+	{
+		__m128i x = _mm_loadu_si128((const __m128i*)(row + i));
+		__m128i b = _mm_loadu_si128((const __m128i*)(prev + i));
+		_mm_storeu_si128((__m128i*)(row + i), _mm_add_epi8(x, b));
+	}
+	unfilter_up_scalar(row, prev, i, len);
+}
+
+// the last pixel of x, bpp is 1, 2, 4 or 8, in every pixel
+static inline __m128i unfilter_last_pixel(__m128i x, int bpp)
+{
+	if (bpp == 1)
+	{
+		__m128i last = _mm_srli_si128(x, 15);
+		last = _mm_unpacklo_epi8(last, last);
+		last = _mm_unpacklo_epi16(last, last);
+		return _mm_shuffle_epi32(last, 0);
+	}
+	if (bpp == 2)
+	{
+		return _mm_shuffle_epi32(_mm_shufflehi_epi16(x, 0xff), 0xff);
+	}
+	if (bpp == 4)
+	{
+		return _mm_shuffle_epi32(x, 0xff);
+	}
+	return _mm_unpackhi_epi64(x, x);
+}
+
+// the prefix sums of 16 bytes at a time plus the carry, the last sum; the
+// carry of the next step needs only one add, so the steps hardly wait for
+// each other. Pixels of a power of two bytes never cross a step
+static inline void unfilter_sub_pow2_sse2(unsigned char* row, size_t len, int bpp)
+{
+	__m128i carry = _mm_setzero_si128();
+	size_t i = 0;
+	for (; i + 16 <= len; i += 16)
+	{
+		__m128i x = _mm_loadu_si128((const __m128i*)(row + i));
+		if (bpp <= 1)
+		{
+			x = _mm_add_epi8(x, _mm_slli_si128(x, 1));
+		}
+		if (bpp <= 2)
+		{
+			x = _mm_add_epi8(x, _mm_slli_si128(x, 2));
+		}
+		if (bpp <= 4)
+		{
+			x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+		}
+		x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+		_mm_storeu_si128((__m128i*)(row + i), _mm_add_epi8(x, carry));
+		carry = _mm_add_epi8(carry, unfilter_last_pixel(x, bpp));
+	}
+	unfilter_sub_scalar(row, i, len, bpp);
+}
+
+#define UNFILTER_SUB_SSE2_KERNEL(bpp)                                                                \
+	static void unfilter_sub_##bpp##_sse2(unsigned char* row, const unsigned char* prev, size_t len) \
+	{                                                                                                \
+		(void)prev;                                                                                  \
+		unfilter_sub_pow2_sse2(row, len, bpp);                                                       \
+	}
+
+UNFILTER_SUB_SSE2_KERNEL(1)
+UNFILTER_SUB_SSE2_KERNEL(2)
+UNFILTER_SUB_SSE2_KERNEL(4)
+UNFILTER_SUB_SSE2_KERNEL(8)
+
+// five pixels per step; the 16th byte belongs to the next step, so it is
+// written back as it was, and the next step is loaded before that store, as
+// a load overlapping a recent store waits for it
+static void unfilter_sub_3_sse2(unsigned char* row, const unsigned char* prev, size_t len)
+{
+	(void)prev;
+	const __m128i keep = _mm_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, -1);
+	const __m128i pixel = _mm_setr_epi8(-1, -1, -1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+	__m128i carry = _mm_setzero_si128();
+	size_t i = 0;
+	if (len < 16)
+	{
+		unfilter_sub_scalar(row, 0, len, 3);
+		return;
+	}
+
+	__m128i in = _mm_loadu_si128((const __m128i*)row);
+	for (; i + 16 <= len; i += 15)
+	{
+		__m128i next = in;
+		if (i + 31 <= len)
+		{
+			next = _mm_loadu_si128((const __m128i*)(row + i + 15));
+		}
+
+		__m128i x = _mm_add_epi8(in, _mm_slli_si128(in, 3));
+		x = _mm_add_epi8(x, _mm_slli_si128(x, 6));
+		x = _mm_add_epi8(x, _mm_slli_si128(x, 12));
+		__m128i sum = _mm_add_epi8(x, carry);
+		_mm_storeu_si128((__m128i*)(row + i), _mm_or_si128(_mm_andnot_si128(keep, sum), _mm_and_si128(keep, in)));
+
+		__m128i last = _mm_and_si128(_mm_srli_si128(x, 12), pixel);
+		last = _mm_or_si128(last, _mm_slli_si128(last, 3));
+		last = _mm_or_si128(last, _mm_slli_si128(last, 6));
+		last = _mm_or_si128(last, _mm_slli_si128(last, 12));
+		carry = _mm_add_epi8(carry, last);
+		in = next;
+	}
+	unfilter_sub_scalar(row, i, len, 3);
+}
+
+// a pixel in the low bytes of a register. Byte by byte for 3 bytes, a
+// 3-byte memcpy through the stack stalls on store forwarding
+static inline __m128i unfilter_load_3(const unsigned char* ptr)
+{
+	return _mm_cvtsi32_si128(ptr[0] | ptr[1] << 8 | ptr[2] << 16);
+}
+
+static inline void unfilter_store_3(unsigned char* ptr, __m128i x)
+{
+	int v = _mm_cvtsi128_si32(x);
+	ptr[0] = (unsigned char)v;
+	ptr[1] = (unsigned char)(v >> 8);
+	ptr[2] = (unsigned char)(v >> 16);
+}
+
+static inline __m128i unfilter_load_4(const unsigned char* ptr)
+{
+	int v;
+	memcpy(&v, ptr, 4);
+	return _mm_cvtsi32_si128(v);
+}
+
+static inline void unfilter_store_4(unsigned char* ptr, __m128i x)
+{
+	int v = _mm_cvtsi128_si32(x);
+	memcpy(ptr, &v, 4);
+}
+
+static inline __m128i unfilter_load_6(const unsigned char* ptr)
+{
+	return _mm_insert_epi16(unfilter_load_4(ptr), ptr[4] | ptr[5] << 8, 2);
+}
+
+static inline void unfilter_store_6(unsigned char* ptr, __m128i x)
+{
+	unfilter_store_4(ptr, x);
+	int v = _mm_extract_epi16(x, 2);
+	ptr[4] = (unsigned char)v;
+	ptr[5] = (unsigned char)(v >> 8);
+}
+
+static inline __m128i unfilter_load_8(const unsigned char* ptr)
+{
+	return _mm_loadl_epi64((const __m128i*)ptr);
+}
+
+static inline void unfilter_store_8(unsigned char* ptr, __m128i x)
+{
+	_mm_storel_epi64((__m128i*)ptr, x);
+}
+
+static inline __m128i unfilter_select(__m128i mask, __m128i yes, __m128i no)
+{
+	return _mm_or_si128(_mm_and_si128(mask, yes), _mm_andnot_si128(mask, no));
+}
+
+static inline __m128i unfilter_abs_epi16(__m128i x)
+{
+	return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+
+// a pixel per step, the previous pixel stays in a register; Paeth is
+// predicted in 16-bit lanes, like the scalar one
+#define UNFILTER_PIXEL_SSE2_KERNELS(bpp)                                                               \
+	static void unfilter_avg_##bpp##_sse2(unsigned char* row, const unsigned char* prev, size_t len)   \
+	{                                                                                                  \
+		const __m128i one = _mm_set1_epi8(1);                                                          \
+		__m128i a = _mm_setzero_si128();                                                               \
+		for (size_t i = 0; i + bpp <= len; i += bpp)                                                   \
+		{                                                                                              \
+			__m128i b = unfilter_load_##bpp(prev + i);                                                 \
+			/* _mm_avg_epu8 rounds up */                                                               \
+			__m128i avg = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));   \
+			a = _mm_add_epi8(unfilter_load_##bpp(row + i), avg);                                       \
+			unfilter_store_##bpp(row + i, a);                                                          \
+		}                                                                                              \
+	}                                                                                                  \
+	static void unfilter_paeth_##bpp##_sse2(unsigned char* row, const unsigned char* prev, size_t len) \
+	{                                                                                                  \
+		const __m128i zero = _mm_setzero_si128();                                                      \
+		__m128i a = zero;                                                                              \
+		__m128i c = zero;                                                                              \
+		for (size_t i = 0; i + bpp <= len; i += bpp)                                                   \
+		{                                                                                              \
+			__m128i b = _mm_unpacklo_epi8(unfilter_load_##bpp(prev + i), zero);                        \
+			__m128i pa = _mm_sub_epi16(b, c);                                                          \
+			__m128i pb = _mm_sub_epi16(a, c);                                                          \
+			__m128i pc = unfilter_abs_epi16(_mm_add_epi16(pa, pb));                                    \
+			pa = unfilter_abs_epi16(pa);                                                               \
+			pb = unfilter_abs_epi16(pb);                                                               \
+			__m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));                               \
+			__m128i p = unfilter_select(_mm_cmpeq_epi16(pa, smallest), a,                              \
+										unfilter_select(_mm_cmpeq_epi16(pb, smallest), b, c));         \
+                                                                                                       \
+			__m128i x = _mm_add_epi8(unfilter_load_##bpp(row + i), _mm_packus_epi16(p, p));            \
+			unfilter_store_##bpp(row + i, x);                                                          \
+			a = _mm_unpacklo_epi8(x, zero);                                                            \
+			c = b;                                                                                     \
+		}                                                                                              \
+	}
+
+UNFILTER_PIXEL_SSE2_KERNELS(3)
+UNFILTER_PIXEL_SSE2_KERNELS(4)
+UNFILTER_PIXEL_SSE2_KERNELS(6)
+UNFILTER_PIXEL_SSE2_KERNELS(8)
+
+#endif
+
+#ifdef UNFILTER_AVX2
+
+__attribute__((target("avx2"))) static void unfilter_up_avx2(unsigned char* row, const unsigned char* prev, size_t len)
+{
+	size_t i = 0;
+	for (; i + 32 <= len; i += 32)
+	{
+		__m256i x = _mm256_loadu_si256((const __m256i*)(row + i));
+		__m256i b = _mm256_loadu_si256((const __m256i*)(prev + i));
+		_mm256_storeu_si256((__m256i*)(row + i), _mm256_add_epi8(x, b));
+	}
+	unfilter_up_scalar(row, prev, i, len);
+}
+
+static int unfilter_has_avx2(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+
+#endif
+
+// kernels[filter type] for pixels of bpp bytes: 1, 2, 3, 4, 6 or 8 (1 for
+// pixels of less than a byte); simd is 0 for the scalar kernels only,
+// otherwise the best ones this cpu has
+static void unfilter_choose(int bpp, int simd, unfilter_fn kernels[5])
+{
+	kernels[0] = unfilter_none;
+	kernels[2] = unfilter_up;
+	switch (bpp)
+	{
+	case 1:
+		kernels[1] = unfilter_sub_1;
+		kernels[3] = unfilter_avg_1;
+		kernels[4] = unfilter_paeth_1;
+		break;
+	case 2:
+		kernels[1] = unfilter_sub_2;
+		kernels[3] = unfilter_avg_2;
+		kernels[4] = unfilter_paeth_2;
+		break;
+	case 3:
+		kernels[1] = unfilter_sub_3;
+		kernels[3] = unfilter_avg_3;
+		kernels[4] = unfilter_paeth_3;
+		break;
+	case 4:
+		kernels[1] = unfilter_sub_4;
+		kernels[3] = unfilter_avg_4;
+		kernels[4] = unfilter_paeth_4;
+		break;
+	case 6:
+		kernels[1] = unfilter_sub_6;
+		kernels[3] = unfilter_avg_6;
+		kernels[4] = unfilter_paeth_6;
+		break;
+	default:
+		kernels[1] = unfilter_sub_8;
+		kernels[3] = unfilter_avg_8;
+		kernels[4] = unfilter_paeth_8;
+		break;
+	}
+	if (!simd)
+	{
+		return;
+	}
+
+#ifdef UNFILTER_SSE2
+	kernels[2] = unfilter_up_sse2;
+	switch (bpp)
+	{
+	case 1:
+		kernels[1] = unfilter_sub_1_sse2;
+		break;
+	case 2:
+		kernels[1] = unfilter_sub_2_sse2;
+		break;
+	case 3:
+		kernels[1] = unfilter_sub_3_sse2;
+		kernels[3] = unfilter_avg_3_sse2;
+		kernels[4] = unfilter_paeth_3_sse2;
+		break;
+	case 4:
+		kernels[1] = unfilter_sub_4_sse2;
+		kernels[3] = unfilter_avg_4_sse2;
+		kernels[4] = unfilter_paeth_4_sse2;
+		break;
+	case 6:
+		kernels[3] = unfilter_avg_6_sse2;
+		kernels[4] = unfilter_paeth_6_sse2;
+		break;
+	default:
+		kernels[1] = unfilter_sub_8_sse2;
+		kernels[3] = unfilter_avg_8_sse2;
+		kernels[4] = unfilter_paeth_8_sse2;
+		break;
+	}
+#endif
+#ifdef UNFILTER_AVX2
+	if (unfilter_has_avx2())
+	{
+		kernels[2] = unfilter_up_avx2;
+	}
+#endif
+}
+
+#endif